@@ -0,0 +1,74 @@
+/*
+ * Shared helpers for the expression benchmarks
+ *
+ * Included after moth.c. A benchmark defines its prelude and a table
+ * of named expressions, evaluates the prelude once, then times each
+ * expression with the VM and with the tree walker.
+ */
+
+#define BENCH_COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+/* Print the allocations made by each evaluation */
+#define BENCH_ALLOCS 1
+/* Stop with an error unless each evaluation fails */
+#define BENCH_FAILS  2
+/* Read each expression again for each run instead of evaluating a copy
+   that shares its cells, so the evaluation can reuse them in place */
+#define BENCH_FRESH  4
+
+static void bench_prelude(menv *e, char **prelude, int n)
+{
+    for (int i = 0; i < n; i++) {
+        mothval *x = moth_eval(e, mothval_read(prelude[i]));
+        if (mothval_type(x) == MOTHVAL_ERR) {
+            printf("prelude: '%s' failed\n", prelude[i]);
+            exit(1);
+        }
+        mothval_del(x);
+    }
+}
+
+/* Evaluates each expression runs times, timing and counting only the
+   evaluation, not reading or copying it */
+static void bench_cases(char *name, menv *e, char *cases[][2], int n,
+                        int runs, int flags)
+{
+    for (int i = 0; i < n; i++) {
+        mothval *v = mothval_read(cases[i][1]);
+        double ms = 0;
+        long allocs = 0;
+
+        for (int j = 0; j < runs; j++) {
+            mothval *x = (flags & BENCH_FRESH)
+                ? mothval_read(cases[i][1]) : mothval_copy(v);
+            long before = mmem_stats.allocs;
+            double start = moth_now();
+            x = moth_eval(e, x);
+            ms += moth_now() - start;
+            allocs += mmem_stats.allocs - before;
+
+            if ((flags & BENCH_FAILS) && mothval_type(x) != MOTHVAL_ERR) {
+                printf("%s: '%s' did not fail\n", name, cases[i][1]);
+                exit(1);
+            }
+            mothval_del(x);
+        }
+
+        printf("%-12s %-8s %8.2f M/s", name, cases[i][0], runs / ms / 1e3);
+        if (flags & BENCH_ALLOCS) {
+            printf(" %6.2f allocs/eval", (double)allocs / runs);
+        }
+        printf("\n");
+        mothval_del(v);
+    }
+}
+
+/* Runs the cases with the VM, then with the tree walker */
+static void bench_modes(menv *e, char *cases[][2], int n, int runs,
+                        int flags)
+{
+    bench_cases("vm", e, cases, n, runs, flags);
+    moth_tree_walk = 1;
+    bench_cases("tree walker", e, cases, n, runs, flags);
+    moth_tree_walk = 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Closure benchmark
+ *
+ * Calls a closure made by another lambda 1M times, with the VM and with
+ * the tree walker, next to a plain lambda doing the same work on values
+ * passed as arguments. A captured variable is bound in the call frame
+ * like a parameter, so both should run at about the same rate. Then
+ * times making closures, which copies what each one captures.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+#include "bench.h"
+
+#define RUNS 1000000
+
+static char *cases[][2] = {
+    { "closure", "add5 1" },
+    { "lambda",  "add 5 1" },
+    { "make",    "adder 5" },
+};
+
+int main(void)
+{
+    menv *e = menv_new();
+    menv_add_builtins(e);
+
+    char *prelude[] = {
+        "def {adder} (\\ {n} {\\ {x} {+ x n}})",
+        "def {add5} (adder 5)",
+        "def {add} (\\ {n x} {+ x n})",
+    };
+    bench_prelude(e, prelude, BENCH_COUNT(prelude));
+
+    bench_modes(e, cases, BENCH_COUNT(cases), RUNS, 0);
+
+    menv_del(e);
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Context benchmark
+ *
+ * Runs 1, 2, 4 and 8 contexts at once, each on a thread of its own,
+ * through the same lines: recursion, closures, whole-list functions,
+ * errors, and definitions of names no context has read before, which
+ * go into the shared symbol table. Prints the time and the lines run
+ * per second, and checks every value against the one from a context
+ * on the main thread.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+
+#define ROUNDS 200
+#define MAX_CTXS 8
+
+static char *prelude[] = {
+    "def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})",
+    "def {adder} (\\ {n} {\\ {x} {+ x n}})",
+    "def {count} (\\ {n} {if (== n 0) {{}} {join (count (- n 1)) (list n)}})",
+};
+
+static char *lines[] = {
+    "fib 15",
+    "map (adder 7) (count 50)",
+    "fold + 0 (filter (\\ {x} {> x 20}) (count 50))",
+    "eval (join {list} (tail {a b c d}))",
+    "head {}",
+    "+ 1 (/ 4 0)",
+};
+
+#define NPRELUDE ((int)(sizeof(prelude) / sizeof(prelude[0])))
+#define NLINES ((int)(sizeof(lines) / sizeof(lines[0])))
+
+static mothval *expected[NLINES];
+
+typedef struct {
+    int id;
+    int failed;
+} job;
+
+static void *run(void *arg)
+{
+    job *j = arg;
+    moth_ctx *c = moth_ctx_new();
+
+    for (int i = 0; i < NPRELUDE; i++) {
+        mothval_del(moth_eval_string(c, prelude[i]));
+    }
+
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < NLINES; i++) {
+            mothval *x = moth_eval_string(c, lines[i]);
+            if (!mothval_eq(x, expected[i])) { j->failed++; }
+            mothval_del(x);
+        }
+
+        /* A name only this context and round use */
+        char def[64], name[32];
+        sprintf(name, "v%d_%d", j->id, r);
+        sprintf(def, "def {%s} %d", name, r);
+        mothval_del(moth_eval_string(c, def));
+        mothval *x = moth_eval_string(c, name);
+        if (mothval_type(x) != MOTHVAL_NUM || mothval_to_num(x) != r) {
+            j->failed++;
+        }
+        mothval_del(x);
+    }
+
+    moth_ctx_del(c);
+    moth_thread_end();
+    return NULL;
+}
+
+int main(void)
+{
+    moth_ctx *c = moth_ctx_new();
+    for (int i = 0; i < NPRELUDE; i++) {
+        mothval_del(moth_eval_string(c, prelude[i]));
+    }
+    for (int i = 0; i < NLINES; i++) {
+        expected[i] = moth_eval_string(c, lines[i]);
+    }
+
+    double base = 0;
+    for (int n = 1; n <= MAX_CTXS; n *= 2) {
+        pthread_t threads[MAX_CTXS];
+        job jobs[MAX_CTXS];
+
+        double start = moth_now();
+        for (int i = 0; i < n; i++) {
+            jobs[i].id = n * MAX_CTXS + i;
+            jobs[i].failed = 0;
+            pthread_create(&threads[i], NULL, run, &jobs[i]);
+        }
+        for (int i = 0; i < n; i++) { pthread_join(threads[i], NULL); }
+        double ms = moth_now() - start;
+
+        for (int i = 0; i < n; i++) {
+            if (jobs[i].failed) {
+                printf("%d contexts: context %d gave %d wrong values\n",
+                       n, i, jobs[i].failed);
+                exit(1);
+            }
+        }
+
+        double rate = (double)n * ROUNDS * (NLINES + 2) / ms;
+        if (n == 1) { base = rate; }
+        printf("%d contexts %9.1f ms %9.1f k lines/s %6.2fx\n", n, ms, rate,
+               rate / base);
+    }
+
+    for (int i = 0; i < NLINES; i++) { mothval_del(expected[i]); }
+    moth_ctx_del(c);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Embedding benchmark
+ *
+ * Calls the interpreter through moth.h, linked against libmoth.a, the
+ * way a service handling requests in-process would, and prints calls
+ * per second. "line" and "lambda" evaluate a line in a context kept
+ * between calls, "fresh" makes and deletes a context for every call,
+ * "file" evaluates a short file, and "builtin" calls a builtin written
+ * in C and registered through moth.h. Every value is checked.
+ */
+
+#define _DEFAULT_SOURCE
+#include "../moth.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 200000
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void check(char *name, mothval *x, long want)
+{
+    if (moth_type(x) != MOTHVAL_NUM || moth_num(x) != want) {
+        printf("%s: got ", name);
+        moth_print(x);
+        printf(" instead of %ld\n", want);
+        exit(1);
+    }
+    moth_free(x);
+}
+
+/* The first of three numbers, kept between the other two */
+static mothval *clamp(mothval *a)
+{
+    if (moth_count(a) != 3) { return moth_new_err("clamp takes 3 numbers"); }
+    for (int i = 0; i < 3; i++) {
+        if (moth_type(moth_cell(a, i)) != MOTHVAL_NUM) {
+            return moth_new_err("clamp takes 3 numbers");
+        }
+    }
+
+    long x = moth_num(moth_cell(a, 0));
+    long lo = moth_num(moth_cell(a, 1));
+    long hi = moth_num(moth_cell(a, 2));
+    return moth_copy(moth_cell(a, x < lo ? 1 : x > hi ? 2 : 0));
+}
+
+static void report(char *name, int runs, double ms)
+{
+    printf("%-8s %8.1f k calls/s %8.2f us/call\n", name, runs / ms,
+           ms * 1e3 / runs);
+}
+
+int main(void)
+{
+    moth_register_builtin("clamp", clamp);
+
+    moth_ctx *c = moth_ctx_new();
+    moth_free(moth_eval_string(c, "def {sq} (\\ {x} {* x x})"));
+
+    double start = now();
+    for (int i = 0; i < RUNS; i++) {
+        check("line", moth_eval_string(c, "+ 1 (* 2 3)"), 7);
+    }
+    report("line", RUNS, now() - start);
+
+    start = now();
+    for (int i = 0; i < RUNS; i++) {
+        check("lambda", moth_eval_string(c, "sq 12"), 144);
+    }
+    report("lambda", RUNS, now() - start);
+
+    start = now();
+    for (int i = 0; i < RUNS / 10; i++) {
+        moth_ctx *f = moth_ctx_new();
+        check("fresh", moth_eval_string(f, "+ 1 (* 2 3)"), 7);
+        moth_ctx_del(f);
+    }
+    report("fresh", RUNS / 10, now() - start);
+
+    char path[] = "/tmp/moth-embed-XXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fdopen(fd, "w");
+    fputs("def {cube} (\\ {x} {\n    * x (sq x)\n})\n\ncube 3\n", f);
+    fclose(f);
+
+    start = now();
+    for (int i = 0; i < RUNS / 10; i++) {
+        check("file", moth_eval_file(c, path), 27);
+    }
+    report("file", RUNS / 10, now() - start);
+
+    unlink(path);
+
+    start = now();
+    for (int i = 0; i < RUNS; i++) {
+        check("builtin", moth_eval_string(c, "clamp (sq 5) 0 (+ 2 8)"), 10);
+    }
+    report("builtin", RUNS, now() - start);
+
+    mothval *x = moth_eval_string(c, "+ 1 (clamp 1 2)");
+    if (moth_type(x) != MOTHVAL_ERR
+        || strcmp(moth_err(x), "clamp takes 3 numbers") != 0) {
+        printf("builtin: error not passed on\n");
+        exit(1);
+    }
+    moth_free(x);
+
+    moth_ctx_del(c);
+    return 0;
+}
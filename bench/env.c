@@ -0,0 +1,73 @@
+/*
+ * Environment lookup benchmark
+ *
+ * Binds an increasing number of symbols and times menv_get against
+ * them. The "hot" column looks up the same ten names at every size, the
+ * way a program touches a few names while its prelude grows, and should
+ * stay flat up to 100k bindings. The "spread" column strides over every
+ * binding and also shows the table outgrowing the CPU caches.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#define MOTH_NO_MAIN
+#include "../moth.c"
+
+#include <time.h>
+
+#define LOOKUPS 1000000
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    menv *e = menv_new();
+    mothval **keys = malloc(sizeof(mothval *) * 100000);
+    char name[32];
+    int bound = 0;
+
+    for (int i = 0; i < 100000; i++) {
+        snprintf(name, sizeof(name), "sym%d", i);
+        keys[i] = mothval_sym(name);
+    }
+
+    printf("%10s %16s %16s\n", "bindings", "hot ns/lookup",
+           "spread ns/lookup");
+
+    for (int n = 10; n <= 100000; n *= 10) {
+        while (bound < n) {
+            mothval *v = mothval_num(bound);
+            menv_put(e, keys[bound], v);
+            mothval_del(v);
+            bound++;
+        }
+
+        double start = now();
+        for (int i = 0; i < LOOKUPS; i++) {
+            mothval_del(menv_get(e, keys[i % 10]));
+        }
+        double hot = now() - start;
+
+        /* Stride through all the bound keys so that consecutive lookups
+           land on different cache lines */
+        unsigned long k = 0;
+        start = now();
+        for (int i = 0; i < LOOKUPS; i++) {
+            k = (k + 7919) % n;
+            mothval_del(menv_get(e, keys[k]));
+        }
+        double spread = now() - start;
+
+        printf("%10d %16.1f %16.1f\n", n, hot * 1e9 / LOOKUPS,
+               spread * 1e9 / LOOKUPS);
+    }
+
+    for (int i = 0; i < 100000; i++) { mothval_del(keys[i]); }
+    free(keys);
+    menv_del(e);
+    return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * Error benchmark
+ *
+ * Evaluates expressions that fail, with the VM and with the tree
+ * walker, and prints the rate and the allocations made while
+ * evaluating each one, not counting reading it. An error stops the
+ * evaluation of everything it is nested in, so the "early" case, whose
+ * first argument fails before an expensive second one, costs no more
+ * than the others, and raising the error itself allocates nothing.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+#include "bench.h"
+
+#define RUNS 200000
+
+static char *cases[][2] = {
+    { "builtin", "head {}" },
+    { "nested",  "+ 1 (+ 1 (+ 1 (/ 1 0)))" },
+    { "unbound", "list 1 2 nope 4" },
+    { "lambda",  "fail 1" },
+    { "early",   "+ nope (loop 1000)" },
+};
+
+int main(void)
+{
+    menv *e = menv_new();
+    menv_add_builtins(e);
+
+    char *prelude[] = {
+        "def {fail} (\\ {x} {+ x nope})",
+        "def {loop} (\\ {n} {if (== n 0) {n} {loop (- n 1)}})",
+    };
+    bench_prelude(e, prelude, BENCH_COUNT(prelude));
+
+    bench_modes(e, cases, BENCH_COUNT(cases), RUNS,
+                BENCH_ALLOCS | BENCH_FAILS | BENCH_FRESH);
+
+    menv_del(e);
+    return 0;
+}
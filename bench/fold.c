@@ -0,0 +1,71 @@
+/*
+ * Constant folding benchmark
+ *
+ * Calls lambdas whose bodies compute literal arithmetic and build
+ * literal lists, with the VM and with the tree walker, and prints the
+ * rate and the allocations made by each call. The VM folds those
+ * expressions when it compiles the body, so a call only pushes their
+ * values. The "unfolded" rows redefine a builtin first, which has every
+ * folded call run as written again. First checks that calls which
+ * overflow fail with an error when they run, with the VM and with the
+ * tree walker, and cost nothing in branches that are never taken.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+#include "bench.h"
+
+#define RUNS 1000000
+
+static char *cases[][2] = {
+    { "arith", "f 1" },
+    { "lists", "g 1" },
+};
+
+int main(void)
+{
+    menv *e = menv_new();
+    menv_add_builtins(e);
+
+    char *prelude[] = {
+        "def {f} (\\ {x} {+ x (* 60 60 24) (- (/ 1000 8) 1)})",
+        "def {g} (\\ {x} {join (list 1 2 3) (tail {0 4 5 6}) (head {7 8})})",
+    };
+    bench_prelude(e, prelude, BENCH_COUNT(prelude));
+
+    /* Calls that overflow or trap fail, so they are not folded and cost
+       nothing in a branch that is not taken */
+    char *overflows[] = {
+        "def {h} (\\ {x} {if x {/ -9223372036854775808 -1} {0}})",
+        "def {h} (\\ {x} {if x {+ 9223372036854775807 1} {0}})",
+        "def {h} (\\ {x} {if x {* 4611686018427387904 2} {0}})",
+        "def {h} (\\ {x} {if x {- -9223372036854775808} {0}})",
+    };
+    for (int i = 0; i < BENCH_COUNT(overflows); i++) {
+        mothval_del(moth_eval(e, mothval_read(overflows[i])));
+        for (moth_tree_walk = 0; moth_tree_walk < 2; moth_tree_walk++) {
+            mothval *x = moth_eval(e, mothval_read("h 0"));
+            mothval *y = moth_eval(e, mothval_read("h 1"));
+            if (mothval_type(x) != MOTHVAL_NUM || mothval_to_num(x) != 0
+                || mothval_type(y) != MOTHVAL_ERR
+                || mothval_err_code(y) != MERR_OVERFLOW) {
+                printf("'%s' did not give 0 and overflow\n", overflows[i]);
+                exit(1);
+            }
+            mothval_del(x);
+            mothval_del(y);
+        }
+    }
+    moth_tree_walk = 0;
+
+    bench_modes(e, cases, BENCH_COUNT(cases), RUNS, BENCH_ALLOCS);
+
+    /* Binding a builtin to itself is still a redefinition */
+    mothval_del(moth_eval(e, mothval_read("def {+} +")));
+    bench_cases("unfolded", e, cases, BENCH_COUNT(cases), RUNS,
+                BENCH_ALLOCS);
+
+    menv_del(e);
+    return 0;
+}
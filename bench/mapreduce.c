@@ -0,0 +1,86 @@
+/*
+ * Map and reduce benchmark
+ *
+ * Maps a lambda over a list of 20k numbers and folds one over it, with
+ * 'map' and 'fold' and with 'pmap' and 'preduce' on 1, 2, 4 and 8
+ * threads, and prints the time and the speedup over one thread. Every
+ * result is checked against the one from 'map' or 'fold'. Each function
+ * does the same work per cell, so the list splits evenly at any grain.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+
+#define CELLS 20000
+
+static char *cases[][3] = {
+    /* name, expression, expression checked against */
+    { "map",    "pmap work l",            "map work l" },
+    { "reduce", "preduce add 0 l",        "fold add 0 l" },
+};
+
+#define NCASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+/* "def {l} {0 1 ... n-1}" */
+static char *list_def(int n)
+{
+    char *s = malloc(16 + (size_t)n * 12);
+    char *p = s + sprintf(s, "def {l} {");
+    for (int i = 0; i < n; i++) { p += sprintf(p, "%d ", i); }
+    sprintf(p, "}");
+    return s;
+}
+
+static double run(menv *e, char *src, mothval **x)
+{
+    double start = moth_now();
+    *x = moth_eval(e, mothval_read(src));
+    return moth_now() - start;
+}
+
+int main(void)
+{
+    double base[NCASES];
+    char *def = list_def(CELLS);
+    moth_grain = 256;
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        mpar_start(threads);
+
+        menv *e = menv_new();
+        menv_add_builtins(e);
+        char *prelude[] = {
+            def,
+            "def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})",
+            "def {work} (\\ {x} {+ x (fib 7)})",
+            "def {add} (\\ {a b} {+ a (- (fib 7) (fib 7)) b})",
+        };
+        for (int i = 0; i < 4; i++) {
+            mothval_del(moth_eval(e, mothval_read(prelude[i])));
+        }
+
+        for (int i = 0; i < NCASES; i++) {
+            mothval *expected, *x;
+            double seq = run(e, cases[i][2], &expected);
+            double ms = run(e, cases[i][1], &x);
+            if (threads == 1) { base[i] = seq; }
+
+            if (mothval_type(x) == MOTHVAL_ERR || !mothval_eq(x, expected)) {
+                printf("%d threads: '%s' gave a different result\n",
+                       threads, cases[i][1]);
+                exit(1);
+            }
+            mothval_del(x);
+            mothval_del(expected);
+
+            printf("%d threads %-6s %9.1f ms sequential %9.1f ms parallel "
+                   "%6.2fx\n", threads, cases[i][0], seq, ms, base[i] / ms);
+        }
+
+        menv_del(e);
+    }
+
+    free(def);
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Nesting benchmark
+ *
+ * Times reading, evaluating, printing and freeing a short expression
+ * 1M times, which is what most input looks like and should not get
+ * slower for the explicit stacks that the deep cases need. Then runs
+ * expressions nested 1k to 100k levels deep through the same steps,
+ * where the cost per level should stay flat and nothing should crash.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SHALLOW 1000000
+
+static int saved_stdout;
+
+/* Send printed values to /dev/null while they are being timed */
+static void quiet(void)
+{
+    fflush(stdout);
+    saved_stdout = dup(1);
+    int fd = open("/dev/null", O_WRONLY);
+    dup2(fd, 1);
+    close(fd);
+}
+
+static void loud(void)
+{
+    fflush(stdout);
+    dup2(saved_stdout, 1);
+    close(saved_stdout);
+}
+
+/* Read, evaluate, print and free 'src' 'n' times, adding the time spent
+   in each step to 't' */
+static void run(menv *e, char *src, int n, double t[4])
+{
+    quiet();
+    for (int i = 0; i < n; i++) {
+        double start = moth_now();
+        mothval *x = mothval_read(src);
+        double read = moth_now();
+        x = moth_eval(e, x);
+        double eval = moth_now();
+        mothval_println(x);
+        fflush(stdout);
+        double print = moth_now();
+        mothval_del(x);
+        double del = moth_now();
+
+        t[0] += read - start;
+        t[1] += eval - read;
+        t[2] += print - eval;
+        t[3] += del - print;
+    }
+    loud();
+}
+
+/* 'depth' copies of 'open', then 'middle', then 'depth' of 'close' */
+static char *nest(char *open, char *middle, char *close, int depth)
+{
+    size_t lo = strlen(open), lm = strlen(middle), lc = strlen(close);
+    char *s = malloc(depth * (lo + lc) + lm + 1);
+    char *p = s;
+    for (int i = 0; i < depth; i++) { memcpy(p, open, lo); p += lo; }
+    memcpy(p, middle, lm); p += lm;
+    for (int i = 0; i < depth; i++) { memcpy(p, close, lc); p += lc; }
+    *p = '\0';
+    return s;
+}
+
+static void bench(menv *e, char *name, char *open, char *middle, char *close)
+{
+    for (int depth = 1000; depth <= 100000; depth *= 10) {
+        char *src = nest(open, middle, close, depth);
+        double t[4] = {0};
+        run(e, src, 1, t);
+        printf("%-10s %7d levels %8.1f %8.1f %8.1f %8.1f ns/level\n",
+               name, depth, t[0] * 1e6 / depth, t[1] * 1e6 / depth,
+               t[2] * 1e6 / depth, t[3] * 1e6 / depth);
+        free(src);
+    }
+}
+
+int main(void)
+{
+    menv *e = menv_new();
+    menv_add_builtins(e);
+
+    printf("%-10s %14s %8s %8s %8s %8s\n", "", "", "read", "eval", "print",
+           "free");
+
+    double t[4] = {0};
+    run(e, "list 1 (+ 2 3) {a b {c d}} (head {4 5 6})", SHALLOW, t);
+    printf("%-10s %7d times  %8.1f %8.1f %8.1f %8.1f ns/line\n", "shallow",
+           SHALLOW, t[0] * 1e6 / SHALLOW, t[1] * 1e6 / SHALLOW,
+           t[2] * 1e6 / SHALLOW, t[3] * 1e6 / SHALLOW);
+
+    bench(e, "calls", "(+ 1 ", "0", ")");
+    bench(e, "quoted", "{", "x", "}");
+    bench(e, "wrapped", "(", "+ 1 2", ")");
+
+    menv_del(e);
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Parallel evaluation benchmark
+ *
+ * Evaluates calls whose arguments are independent calls of lambdas on
+ * 1, 2, 4 and 8 threads, and prints the time and how many calls had
+ * their arguments evaluated in parallel. Checks that every result is
+ * the same as on one thread, that one thread makes no parallel calls,
+ * and that the "small" case, which only calls builtins, never forks.
+ * How much faster more threads are depends on having a core for each.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+
+static char *cases[][3] = {
+    /* name, expression, times evaluated */
+    { "fib",   "fib 24", "1" },
+    { "sum",   "+ (fib 21) (fib 21) (fib 21) (fib 21)", "1" },
+    { "map",   "sum (squares 40)", "20" },
+    { "small", "+ (* 2 3) (- 9 4) (/ 8 2)", "200000" },
+};
+
+#define NCASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+int main(void)
+{
+    mothval *expected[NCASES];
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        mpar_start(threads);
+
+        /* Chunks compiled for one thread have no parallel calls, so each
+           count gets its own environment and code */
+        menv *e = menv_new();
+        menv_add_builtins(e);
+        char *prelude[] = {
+            "def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})",
+            "def {squares} (\\ {n} {if (== n 0) {{}} "
+                "{join (list (* (fib 12) n)) (squares (- n 1))}})",
+            "def {sum} (\\ {l} {if (== l {}) {0} "
+                "{+ (eval (head l)) (sum (tail l))}})",
+        };
+        for (int i = 0; i < (int)(sizeof(prelude) / sizeof(prelude[0])); i++) {
+            mothval_del(moth_eval(e, mothval_read(prelude[i])));
+        }
+
+        for (int i = 0; i < NCASES; i++) {
+            int runs = atoi(cases[i][2]);
+            long calls = __atomic_load_n(&mpar_calls, __ATOMIC_RELAXED);
+            mothval *x = NULL;
+            double start = moth_now();
+            for (int j = 0; j < runs; j++) {
+                if (x) { mothval_del(x); }
+                x = moth_eval(e, mothval_read(cases[i][1]));
+            }
+            double ms = moth_now() - start;
+            long forked = __atomic_load_n(&mpar_calls, __ATOMIC_RELAXED)
+                - calls;
+
+            int small = strcmp(cases[i][0], "small") == 0;
+            if (forked > 0 && (threads == 1 || small)) {
+                printf("%d threads: '%s' made %ld parallel calls\n",
+                       threads, cases[i][1], forked);
+                exit(1);
+            }
+
+            if (threads == 1) {
+                expected[i] = x;
+            } else {
+                if (!mothval_eq(x, expected[i])) {
+                    printf("%d threads: '%s' gave a different result\n",
+                           threads, cases[i][1]);
+                    exit(1);
+                }
+                mothval_del(x);
+            }
+
+            printf("%d threads %-6s %9.1f ms %8ld parallel calls\n",
+                   threads, cases[i][0], ms, forked);
+        }
+
+        menv_del(e);
+    }
+
+    for (int i = 0; i < NCASES; i++) { mothval_del(expected[i]); }
+    return 0;
+}
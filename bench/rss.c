@@ -0,0 +1,32 @@
+/*
+ * Value layout memory benchmark
+ *
+ * Builds a Q-Expression of 10M symbols, so that every element is a
+ * heap node, and reports the node size and the peak resident set.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+
+#include <sys/resource.h>
+
+#define ELEMENTS 10000000
+
+int main(void)
+{
+    mothval *q = mothval_qexpr();
+    for (int i = 0; i < ELEMENTS; i++) {
+        q = mothval_add(q, mothval_sym("x"));
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("sizeof(mothval): %zu bytes\n", sizeof(mothval));
+    printf("elements:        %d\n", q->count);
+    printf("peak RSS:        %.1f MB\n", ru.ru_maxrss / 1024.0);
+
+    mothval_del(q);
+    return 0;
+}
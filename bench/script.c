@@ -0,0 +1,81 @@
+/*
+ * Script benchmark
+ *
+ * Writes generated scripts to a file and runs them with moth_eval_file,
+ * which reads them a block at a time the way 'moth file.moth' does, and
+ * prints the time and the rate in megabytes per second. "lines" has 200k
+ * short definitions, "long" one line of a 1M number list, and "nested"
+ * a lambda spread over many lines, so the cost of reading should not
+ * depend on where the newlines are.
+ */
+
+#define _DEFAULT_SOURCE
+#define MOTH_NO_MAIN
+#include "../moth.c"
+
+#include <unistd.h>
+
+#define LINES 200000
+#define CELLS 1000000
+
+static char path[] = "/tmp/moth-script-XXXXXX";
+
+static void gen_lines(FILE *f)
+{
+    fputs("def {sq} (\\ {x} {* x x})\n", f);
+    for (int i = 0; i < LINES; i++) { fprintf(f, "def {v%d} (sq %d)\n", i, i); }
+    fprintf(f, "- v%d v%d\n", LINES - 1, LINES - 2);
+}
+
+static void gen_long(FILE *f)
+{
+    fputs("fold + 0 {", f);
+    for (int i = 0; i < CELLS; i++) { fprintf(f, "%d ", i % 3); }
+    fputs("}\n", f);
+}
+
+static void gen_nested(FILE *f)
+{
+    fputs("def {f} (\\ {x} {\n", f);
+    for (int i = 0; i < LINES; i++) { fputs("  + 1 (\n", f); }
+    fputs("  x\n", f);
+    for (int i = 0; i < LINES; i++) { fputs(")\n", f); }
+    fputs("})\nf 0\n", f);
+}
+
+static void bench(moth_ctx *c, char *name,
+                  void (*gen)(FILE *f), long want)
+{
+    FILE *f = fopen(path, "w");
+    gen(f);
+    long size = ftell(f);
+    fclose(f);
+
+    double start = moth_now();
+    mothval *x = moth_eval_file(c, path);
+    double ms = moth_now() - start;
+
+    if (mothval_type(x) != MOTHVAL_NUM || mothval_to_num(x) != want) {
+        printf("%s: got ", name);
+        mothval_println(x);
+        exit(1);
+    }
+    mothval_del(x);
+
+    printf("%-8s %9.1f ms %8.1f MB/s\n", name, ms, size / ms / 1e3);
+}
+
+int main(void)
+{
+    close(mkstemp(path));
+    moth_ctx *c = moth_ctx_new();
+
+    long sq = (long)(LINES - 1) * (LINES - 1) - (long)(LINES - 2) * (LINES - 2);
+    bench(c, "lines", gen_lines, sq);
+    bench(c, "long", gen_long, CELLS / 3 * 3 + (CELLS % 3 == 2));
+    bench(c, "nested", gen_nested, LINES);
+
+    unlink(path);
+    moth_ctx_del(c);
+    return 0;
+}
@@ -1,49 +1,298 @@
-#include "mpc.h"
+#define _DEFAULT_SOURCE
 
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "moth.h"
 
-struct mval;
 struct menv;
-typedef struct mval mval;
+struct mchunk;
 typedef struct menv menv;
+typedef struct mchunk mchunk;
+
+/* An interned symbol name. There is exactly one per distinct name, so
+   two symbols are the same when their pointers are */
+typedef struct msym {
+    unsigned long hash;
+    char name[];
+} msym;
+
+/* A global binding. Each is allocated on its own, so compiled code
+   can point straight at it, and lives as long as its environment. A
+   name that code refers to before it is defined has a NULL value */
+typedef struct mbind {
+    msym *sym;
+    struct mothval *val;
+} mbind;
 
+/* The global environment is an open-addressed hash table from interned
+   symbols to bindings. 'cap' is a power of two and empty slots have a
+   NULL symbol.
+
+   A lambda call runs in a frame whose parent is the global environment.
+   A frame has no table: the value of its i'th parameter 'syms[i]' is
+   'vals[i]', so code compiled for it can index the value directly */
 struct menv {
+    menv *par;
     int count;
-    char **syms;
-    mothval **vals;
-};
+    int cap;
+    msym **syms;
+    mbind **binds;
+    struct mothval **vals;
 
-/* Possible Moth value types */
-enum { MOTHVAL_NUM, MOTHVAL_ERR, MOTHVAL_SYM, MOTHVAL_SEXPR,
-       MOTHVAL_QEXPR, MOTHVAL_FUN };
+    /* Distinguishes the global environment from any that came before,
+       even one at the same address */
+    unsigned long id;
+
+    /* Times a global bound to a builtin has been given another value,
+       and times any global has been given a value */
+    unsigned long redefs;
+    unsigned long defs;
+};
 
-typedef mval* (*mbuiltin)(menv*, mval*);
+typedef mothval* (*mbuiltin)(menv*, mothval*);
 
+/* Each value only uses the fields for its own type, so they share a
+   union. Error messages are stored inline after the node, which is
+   allocated with room for them */
 struct mothval {
-    int type;
-    long num;
-    /* Error and symbol types have string data */
-    char *err;
-    char *sym;
-    mbuiltin fun;
+    unsigned char type;
+
+    /* Log2 of the number of cells a list has room for */
+    unsigned char cap;
 
-    /* Count and pointer to a list of "mothval*" */
+    /* Number of references to this value. Values with more than one are
+       shared and must be copied before they are changed */
+    unsigned short refs;
+
+    /* Number of cells in a list, length of an error message, or number
+       of parameters of a lambda */
     int count;
-    struct mothval **cell;
+
+    union {
+        /* Value of a number, or the code of an error */
+        long num;
+        msym *sym;
+
+        /* A builtin, or one registered through moth.h, which is called
+           in its place if it is set */
+        struct {
+            mbuiltin fun;
+            moth_builtin native;
+        };
+
+        /* Where the collector moved a value out of the nursery */
+        struct mothval *forward;
+
+        /* Parameter symbols and body of a lambda, both Q-Expressions. A
+           closure's formals go on after its parameters with the symbols
+           of the variables it captured, then their values */
+        struct {
+            struct mothval *formals;
+            struct mothval *body;
+        };
+
+        /* Cells of a list, and the bytecode for evaluating it as an
+           S-Expression, compiled on first use and shared between copies */
+        struct {
+            struct mothval **cell;
+            mchunk *code;
+        };
+    };
+
+    char err[];
 };
 
-typedef struct mothval mothval;
+_Static_assert(sizeof(struct mothval) <= 24, "mothval must fit in 24 bytes");
 
-#ifdef _WIN32
-#include <string.h>
+/* A value whose count would overflow is copied instead of shared */
+#define MOTHVAL_MAX_REFS USHRT_MAX
+
+/* Lists are allocated with room for a few cells right after the node,
+   and only move their cells to a separate array when they outgrow it */
+#define MOTHVAL_INLINE_LOG 2
+#define MOTHVAL_INLINE (1 << MOTHVAL_INLINE_LOG)
+#define MOTHVAL_LIST_SIZE \
+    (sizeof(struct mothval) + sizeof(struct mothval *) * MOTHVAL_INLINE)
+
+#define mothval_inline(v) ((mothval **)((v) + 1))
+#define mothval_is_inline(v) ((v)->cell == mothval_inline(v))
+
+/* Cells that do not fit inline live in a reference-counted block, which
+   copies of a list share until one of them changes. A list is a window
+   of 'count' cells starting at 'cell', anywhere inside its block, so
+   taking the head or tail of a list only narrows the window. The block
+   owns the values in items[lo..hi) and deletes them once the last list
+   using it is gone */
+typedef struct mcells {
+    int refs;
+    int lo;
+    int hi;
+
+    /* Log2 of the capacity, and the state of the block for the collector */
+    unsigned char cap;
+    unsigned char flags;
+
+    struct mothval *items[];
+} mcells;
+
+/* A list with a block keeps its pointer in the first inline slot, which
+   it no longer uses for a cell */
+#define mothval_block(v) (*(mcells **)mothval_inline(v))
+#define mothval_shared(v) \
+    (!mothval_is_inline(v) && mref_get(mothval_block(v)->refs) > 1)
+
+/* Numbers that fit in 62 bits are stored in the pointer itself, shifted
+   up past a tag in the low two bits, and are never allocated. Every
+   other value is at least 8-byte aligned, so its tag bits are zero */
+#define MOTHVAL_FIXNUM 1
+#define MOTHVAL_FIXNUM_MAX (LONG_MAX >> 2)
+#define MOTHVAL_FIXNUM_MIN (LONG_MIN >> 2)
+
+#define mothval_is_fixnum(v) (((uintptr_t)(v) & 3) == MOTHVAL_FIXNUM)
+
+/* Errors the interpreter raises itself are preallocated, one for each
+   code below, so raising one allocates nothing. Such an error is a
+   pointer to its message in merror_msgs, tagged like a number */
+enum {
+    MERR_UNBOUND, MERR_BAD_NUMBER, MERR_NOT_FUNCTION, MERR_CALL_ARGS,
+    MERR_OP_TYPE, MERR_DIV_ZERO, MERR_OVERFLOW,
+    MERR_HEAD_ARGS, MERR_HEAD_TYPE, MERR_HEAD_EMPTY,
+    MERR_TAIL_ARGS, MERR_TAIL_TYPE, MERR_TAIL_EMPTY,
+    MERR_EVAL_ARGS, MERR_EVAL_TYPE, MERR_JOIN_TYPE,
+    MERR_LAMBDA_ARGS, MERR_LAMBDA_TYPE, MERR_LAMBDA_FORMAL,
+    MERR_CMP_ARGS, MERR_CMP_TYPE,
+    MERR_IF_ARGS, MERR_IF_COND, MERR_IF_BRANCH,
+    MERR_DEF_TYPE, MERR_DEF_SYM, MERR_DEF_COUNT,
+    MERR_STATS_ARGS, MERR_STATS_TYPE, MERR_STATS_SECTION,
+    MERR_MAP_ARGS, MERR_MAP_TYPE, MERR_FILTER_ARGS, MERR_FILTER_TYPE,
+    MERR_FILTER_COND, MERR_FOLD_ARGS, MERR_FOLD_TYPE,
+    MERR_PMAP_ARGS, MERR_PMAP_TYPE, MERR_PREDUCE_ARGS, MERR_PREDUCE_TYPE,
+    MERR_CANCELLED,
+
+    /* Errors with a message made up when they are raised, which are
+       allocated like other values */
+    MERR_SYNTAX, MERR_OTHER
+};
+
+static const char *merror_msgs[] = {
+    [MERR_UNBOUND] = "unbound symbol!",
+    [MERR_BAD_NUMBER] = "Invalid number",
+    [MERR_NOT_FUNCTION] = "The first element is not a function",
+    [MERR_CALL_ARGS] = "Lambda passed wrong number of arguments!",
+    [MERR_OP_TYPE] = "Can't operate on non-number!",
+    [MERR_DIV_ZERO] = "Division by zero!",
+    [MERR_OVERFLOW] = "Integer overflow!",
+    [MERR_HEAD_ARGS] = "The function 'head' passed too many arguments!",
+    [MERR_HEAD_TYPE] = "Function 'head' passed incorrect types!",
+    [MERR_HEAD_EMPTY] = "Function 'head' passed {}!",
+    [MERR_TAIL_ARGS] = "Function 'tail' passed too many arguments! ",
+    [MERR_TAIL_TYPE] = "Function 'tail' passed incorrect type!",
+    [MERR_TAIL_EMPTY] = "Function 'tail' passed {}!",
+    [MERR_EVAL_ARGS] = "Function 'eval' passed too many arguments!",
+    [MERR_EVAL_TYPE] = "Function 'eval' passed incorrect type!",
+    [MERR_JOIN_TYPE] = "Function 'join' passed incorrect type!",
+    [MERR_LAMBDA_ARGS] = "Function '\\' passed wrong number of arguments!",
+    [MERR_LAMBDA_TYPE] = "Function '\\' passed incorrect type!",
+    [MERR_LAMBDA_FORMAL] = "Cannot define non-symbol!",
+    [MERR_CMP_ARGS] = "Comparison passed wrong number of arguments!",
+    [MERR_CMP_TYPE] = "Comparison passed incorrect type!",
+    [MERR_IF_ARGS] = "Function 'if' passed wrong number of arguments!",
+    [MERR_IF_COND] = "Function 'if' passed incorrect type for condition!",
+    [MERR_IF_BRANCH] = "Function 'if' passed incorrect type for branch!",
+    [MERR_DEF_TYPE] = "Function 'def' passed incorrect type!",
+    [MERR_DEF_SYM] = "Function 'def' cannot define non-symbol!",
+    [MERR_DEF_COUNT] = "Function 'def' passed wrong number of values for symbols!",
+    [MERR_STATS_ARGS] = "Function 'stats' passed too many arguments!",
+    [MERR_STATS_TYPE] = "Function 'stats' passed incorrect type!",
+    [MERR_STATS_SECTION] = "Function 'stats' passed a non-symbol section!",
+    [MERR_MAP_ARGS] = "Function 'map' passed wrong number of arguments!",
+    [MERR_MAP_TYPE] = "Function 'map' passed incorrect type!",
+    [MERR_FILTER_ARGS] = "Function 'filter' passed wrong number of arguments!",
+    [MERR_FILTER_TYPE] = "Function 'filter' passed incorrect type!",
+    [MERR_FILTER_COND] = "Function 'filter' got a non-number from its predicate!",
+    [MERR_FOLD_ARGS] = "Function 'fold' passed wrong number of arguments!",
+    [MERR_FOLD_TYPE] = "Function 'fold' passed incorrect type!",
+    [MERR_PMAP_ARGS] = "Function 'pmap' passed wrong number of arguments!",
+    [MERR_PMAP_TYPE] = "Function 'pmap' passed incorrect type!",
+    [MERR_PREDUCE_ARGS] = "Function 'preduce' passed wrong number of arguments!",
+    [MERR_PREDUCE_TYPE] = "Function 'preduce' passed incorrect type!",
+    [MERR_CANCELLED] = "Evaluation cancelled!",
+};
 
-static char buffer[2048];
+#define MOTHVAL_ERRCODE 2
+#define mothval_error(code) \
+    ((mothval *)((uintptr_t)&merror_msgs[code] | MOTHVAL_ERRCODE))
+#define mothval_is_errcode(v) (((uintptr_t)(v) & 3) == MOTHVAL_ERRCODE)
 
+/* Whether 'v' is a number or error held in the pointer, with no node */
+#define mothval_is_imm(v) (((uintptr_t)(v) & 3) != 0)
+
+/* The type is loaded on its own: compared along with the count, it could
+   otherwise be read in one word with 'refs', which other threads change */
+#define mothval_type(v) (!mothval_is_imm(v) \
+    ? __atomic_load_n(&(v)->type, __ATOMIC_RELAXED) \
+    : mothval_is_fixnum(v) ? MOTHVAL_NUM : MOTHVAL_ERR)
+#define mothval_to_num(v) \
+    (mothval_is_fixnum(v) ? (long)((intptr_t)(v) >> 2) : (v)->num)
+
+/* Evaluate with the tree walker instead of the bytecode VM */
+int moth_tree_walk = 0;
+
+/* Make every copy a deep copy instead of sharing, to check that nothing
+   changes a shared value */
+int moth_deep_copy = 0;
+
+/* Reclaim values with the tracing collector instead of reference counts */
+int moth_gc = 0;
+
+/* Free dead lists a few cells at a time instead of all at once, spending
+   at most moth_pause_budget milliseconds on them between REPL lines */
+int moth_lazy_free = 0;
+double moth_pause_budget = 1;
+
+/* Evaluate the arguments of calls on this many threads */
+int moth_threads = 1;
+
+/* Cells of a list that each task of 'pmap' and 'preduce' is given */
+int moth_grain = 64;
+
+/* With more than one thread, values are shared between threads, so
+   reference counts change atomically */
+#define mref_get(n) __atomic_load_n(&(n), __ATOMIC_RELAXED)
+#define mref_inc(n) (moth_threads > 1 \
+    ? __atomic_add_fetch(&(n), 1, __ATOMIC_RELAXED) : ++(n))
+#define mref_dec(n) (moth_threads > 1 \
+    ? __atomic_sub_fetch(&(n), 1, __ATOMIC_ACQ_REL) : --(n))
+
+/* Held while compiling and while reading the global environment's table,
+   which compiling can grow, once there is more than one thread */
+static pthread_mutex_t mpar_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define mpar_lock_begin() \
+    do { if (moth_threads > 1) { pthread_mutex_lock(&mpar_lock); } } while (0)
+#define mpar_lock_end() \
+    do { if (moth_threads > 1) { pthread_mutex_unlock(&mpar_lock); } } while (0)
+
+/* Only the REPL reads lines from the terminal */
+#ifndef MOTH_NO_MAIN
+#ifdef _WIN32
 /* Fake readline */
 char *readline(char *prompt)
 {
-    fputs(prompt, stout);
+    char buffer[2048];
+    fputs(prompt, stdout);
     fgets(buffer, 2048, stdin);
     char *cpy = malloc(strlen(buffer) + 1);
     strcpy(cpy, buffer);
@@ -57,556 +306,4644 @@ void add_history(char *unused) {}
 #include <editline/readline.h>
 #include <editline/history.h>
 #endif
+#endif
 
-/* Create a new number type mothval */
-mothval *mothval_num(long x) {
-    mothval *v = malloc(sizeof(mothval));
-    v->type = MOTHVAL_NUM;
-    v->num = x;
-    return v;
-}
-
-/* Create a new error type motherr */
-mothval *mothval_err(char *m) {
-    mothval *v = malloc(sizeof(mothval));
-    v->type = MOTHVAL_ERR;
-    v->err = malloc(strlen(m) + 1);
-    strcpy(v->err, m);
-    return v;
-}
+/* Process-wide symbol intern table, open-addressed like menv. Every
+   context reads symbols into it, from any thread, under msym_lock */
+static msym **msym_table = NULL;
+static int msym_count = 0;
+static int msym_cap = 0;
+static pthread_mutex_t msym_lock = PTHREAD_MUTEX_INITIALIZER;
 
-mothval *mothval_sym(char *s)
+unsigned long msym_hash(const char *s, size_t len)
 {
-    mothval *v = malloc(sizeof(mothval));
-    v->type = MOTHVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
-    return v;
+    /* FNV-1a */
+    unsigned long h = 2166136261UL;
+    for (size_t i = 0; i < len; i++) { h = (h ^ (unsigned char)s[i]) * 16777619UL; }
+    return h;
 }
 
-mothval *mothval_sexpr(void)
+void msym_grow(void)
 {
-    mothval *v = malloc(sizeof(mothval));
-    v->type = MOTHVAL_SEXPR;
-    v->count = 0;
-    v->cell = NULL;
-    return v;
+    int cap = msym_cap ? msym_cap * 2 : 256;
+    msym **table = calloc(cap, sizeof(msym *));
+
+    for (int i = 0; i < msym_cap; i++) {
+        if (!msym_table[i]) { continue; }
+        unsigned long j = msym_table[i]->hash & (cap - 1);
+        while (table[j]) { j = (j + 1) & (cap - 1); }
+        table[j] = msym_table[i];
+    }
+
+    free(msym_table);
+    msym_table = table;
+    msym_cap = cap;
 }
 
-mothval *mothval_qexpr(void)
+/* Return the unique msym for the 'len' characters at 'name', creating
+   it on first use */
+msym *msym_intern_len(const char *name, size_t len)
 {
-    mothval *v = malloc(sizeof(mothval));
-    v->type = MOTHVAL_QEXPR;
-    v->count = 0;
-    v->cell = NULL;
-    return v;
+    unsigned long h = msym_hash(name, len);
+    pthread_mutex_lock(&msym_lock);
+
+    /* Keep the load factor under 3/4 */
+    if ((msym_count + 1) * 4 > msym_cap * 3) { msym_grow(); }
+
+    unsigned long i = h & (msym_cap - 1);
+    while (msym_table[i]) {
+        msym *s = msym_table[i];
+        if (s->hash == h && strncmp(s->name, name, len) == 0
+            && s->name[len] == '\0') {
+            pthread_mutex_unlock(&msym_lock);
+            return s;
+        }
+        i = (i + 1) & (msym_cap - 1);
+    }
+
+    msym *s = malloc(sizeof(msym) + len + 1);
+    s->hash = h;
+    memcpy(s->name, name, len);
+    s->name[len] = '\0';
+    msym_table[i] = s;
+    msym_count++;
+    pthread_mutex_unlock(&msym_lock);
+    return s;
 }
 
-mothval *mothval_fun(lbuiltin func)
+msym *msym_intern(const char *name)
 {
-    mothval *v = malloc(sizeof(mval));
-    v->type = MOTHVAL_FUN;
-    v->fun = func;
-    return v;
+    return msym_intern_len(name, strlen(name));
 }
 
-menv *menv_new(void)
+/* Wall clock time in milliseconds, for timing pauses */
+double moth_now(void)
 {
-    menv *e = malloc(sizeof(menv));
-    e->count = 0;
-    e->syms = NULL;
-    e->vals = NULL;
-    return e;
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
 }
 
-void menv_del(menv *e)
+/*
+ * Allocator
+ *
+ * Values and their cell arrays are small and short-lived, so they come
+ * from per-thread slabs split into size classes instead of one malloc
+ * each. There are classes for exactly the size of a value node and of
+ * a list node, and powers of two for everything else. Requests above
+ * the largest class go to malloc, and big ones are mapped on their own,
+ * so that lazy freeing can hand them back to the system a part at a
+ * time.
+ *
+ * With the line arena enabled, everything allocated while a REPL line
+ * is evaluated is bumped out of large blocks and dropped in one go once
+ * the result has been printed. Anything that has to outlive the line,
+ * such as environment bindings and compiled code, is allocated between
+ * mmem_persist_begin and mmem_persist_end.
+ */
+
+#define MMEM_CLASSES 9
+#define MMEM_SLAB_SIZE 65536
+#define MMEM_ARENA_SIZE (1 << 20)
+#define MMEM_MAP_MIN (1 << 18)
+
+typedef struct mmem_free_obj {
+    struct mmem_free_obj *next;
+} mmem_free_obj;
+
+typedef struct mmem_block {
+    struct mmem_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} mmem_block;
+
+typedef struct {
+    long allocs;        /* requests for memory */
+    long frees;
+    long slab_allocs;   /* requests served from a slab */
+    long arena_allocs;  /* requests served from the line arena */
+    long sys_allocs;    /* calls made to malloc */
+    long arena_resets;
+} mmem_counters;
+
+static const size_t mmem_sizes[MMEM_CLASSES] = {
+    16, sizeof(mothval), 32, MOTHVAL_LIST_SIZE, 64, 128, 256, 512, 1024
+};
+
+static _Thread_local mmem_free_obj *mmem_free_list[MMEM_CLASSES];
+static _Thread_local mmem_block *mmem_arena = NULL;
+static _Thread_local int mmem_arena_on = 0;
+static _Thread_local int mmem_persist = 0;
+static _Thread_local mmem_counters mmem_stats;
+
+/* Use the line arena */
+int moth_line_arena = 0;
+
+/* Size class for 'n' bytes, or -1 if it is too big for a slab */
+static int mmem_class(size_t n)
 {
-    for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
-        mval_del(e->vals[i]);
+    for (int c = 0; c < MMEM_CLASSES; c++) {
+        if (n <= mmem_sizes[c]) { return c; }
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    return -1;
 }
 
-mval *menv_get(menv *e, mval *k)
+static int mmem_in_arena(void *p)
 {
-    /* Iterate over all the values in the environment */
-    for (int i = 0; i < e->count; i++) {
-        /* If the stored string matches the symbol string,
-           return a copy of its value */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return mval_copy(e->vals[i]);
+    for (mmem_block *b = mmem_arena; b; b = b->next) {
+        if ((char *)p >= b->data && (char *)p < b->data + b->size) {
+            return 1;
         }
     }
-    /* No symbol found */
-    return mval_err("unbound symbol!");
+    return 0;
 }
 
-void menv_put(menv* e, mval *k, mval *v)
+static void *mmem_arena_alloc(size_t n)
 {
-    /* Iterate over all the elements in the environment
-       to check if the variable already exists */
-    for (int i = 0; i < e->count; i++) {
-        /* If the variable is found, delete the item at
-           that position and replace it with the variable
-           supplies by the user */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            mval_del(e->vals[i]);
-            e->vals[i] = mval_copy(v);
-            return;
-        }
-    }
+    n = (n + 15) & ~(size_t)15;
 
-    /* If there's no existing entry, allocate space for the new one */
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(mval *) * e->count);
-    e->syms = realloc(e->syms, sizeof(char *) * e->count);
+    if (!mmem_arena || mmem_arena->used + n > mmem_arena->size) {
+        size_t size = n > MMEM_ARENA_SIZE ? n : MMEM_ARENA_SIZE;
+        mmem_block *b = malloc(sizeof(mmem_block) + size);
+        mmem_stats.sys_allocs++;
+        b->next = mmem_arena;
+        b->used = 0;
+        b->size = size;
+        mmem_arena = b;
+    }
 
-    /* Copy the contents of mval and symbol string into new location */
-    e->vals[e->count - 1] = mval_copy(v);
-    e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-    strcpy(e->syms[e->count - 1], k->sym);
+    void *p = mmem_arena->data + mmem_arena->used;
+    mmem_arena->used += n;
+    mmem_stats.arena_allocs++;
+    return p;
 }
 
-mval *mval_eval(menv *e, mval* v)
+/* Carve a fresh slab into free objects of class 'c' */
+static void mmem_refill(int c)
 {
-    if (v->type == MVAL_SYM) {
-        mval *x = menv_get(e, v);
-        mval_del(v);
-        return x;
-    }
+    size_t size = mmem_sizes[c];
+    char *slab = malloc(MMEM_SLAB_SIZE);
+    mmem_stats.sys_allocs++;
 
-    if (v->type == MVAL_SEXPR) { return mval_eval_sexpr(e, v); }
-    return v;
+    for (size_t off = 0; off + size <= MMEM_SLAB_SIZE; off += size) {
+        mmem_free_obj *o = (mmem_free_obj *)(slab + off);
+        o->next = mmem_free_list[c];
+        mmem_free_list[c] = o;
+    }
 }
 
-mval *mval_eval_sexpr(menv *e, mval *e)
+void *mmem_alloc(size_t n)
 {
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = mval_eval(e, v->cell[i]);
-    }
-
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == MVAL_ERR) { return mval_take(v, i); }
-    }
+    if (n == 0) { return NULL; }
+    mmem_stats.allocs++;
 
-    if (v->count == 0) { return v; }
-    if (v->count == 1) { return mval_take(v, 0); }
+    if (mmem_arena_on && !mmem_persist) { return mmem_arena_alloc(n); }
 
-    /* Ensure that the first element is a function, after eval */
-    mval *f = mval_pop(v, 0);
-    if (f->type != MVAL_FUN) {
-        mval_del(v); mval_del(f);
-        return mval_err("The first element is not a function");
+    int c = mmem_class(n);
+    if (c < 0) {
+        mmem_stats.sys_allocs++;
+        if (n < MMEM_MAP_MIN) { return malloc(n); }
+        void *p = mmap(NULL, n, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p != MAP_FAILED ? p : NULL;
     }
 
-    /* Call function to get result */
-    mval *result = f->fun(e, v);
-    mval_del(f);
-    return result;
+    if (!mmem_free_list[c]) { mmem_refill(c); }
+    mmem_free_obj *o = mmem_free_list[c];
+    mmem_free_list[c] = o->next;
+    mmem_stats.slab_allocs++;
+    return o;
 }
 
-void mothval_del(mothval *v)
+/* Free 'p', which was allocated with size 'n' */
+void mmem_free(void *p, size_t n)
 {
-    switch (v->type) {
-    case MOTHVAL_NUM: break;
+    if (!p) { return; }
+    mmem_stats.frees++;
 
-    /* Free string data */
-    case MOTHVAL_ERR: free(v->err); break;
-    case MOTHVAL_SYM: free(v->sym); break;
-
-    case MOTHVAL_FUN: break;
+    /* Arena memory goes away when the arena is reset */
+    if (mmem_arena && mmem_in_arena(p)) { return; }
 
-    /* If Qexpr or Sexpr, delete all elements inside */
-    case MOTHVAL_QEXPR:
-    case MOTHVAL_SEXPR:
-        for (int i = 0; i < v->count; i++) {
-            mothval_del(v->cell[i]);
-        }
-        /* Free the memory allocated to contain the pointers */
-        free(v->cell);
-        break;
+    int c = mmem_class(n);
+    if (c < 0) {
+        if (n < MMEM_MAP_MIN) { free(p); } else { munmap(p, n); }
+        return;
     }
 
-    free(v);
+    mmem_free_obj *o = p;
+    o->next = mmem_free_list[c];
+    mmem_free_list[c] = o;
 }
 
-mothval *mothval_read_num(mpc_ast_t *t)
+/* Give back bytes 'from' to 'to' of 'p', which was allocated with
+   at least MMEM_MAP_MIN bytes. 'from' is a multiple of the page size,
+   and the rest of 'p' stays usable */
+void mmem_unmap(void *p, size_t from, size_t to)
 {
-    errno = 0;
-    long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? mothval_num(x) : mothval_err("Invalid number");
+    munmap((char *)p + from, to - from);
 }
 
-mothval *mothval_add(mothval *v, mothval *x)
+/* Whether 'p' will be dropped with the line arena while the memory being
+   allocated now has to outlive it */
+int mmem_outlived(void *p)
 {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(mothval *) * v->count);
-    v->cell[v->count - 1] = x;
-    return v;
+    return mmem_persist && mmem_arena && mmem_in_arena(p);
 }
 
-mothval *mothval_read(mpc_ast_t *t)
-{
-    /* If we read a symbol or number, return the conversion to that type */
-    if (strstr(t->tag, "number")) { return mothval_read_num(t); }
-    if (strstr(t->tag, "symbol")) { return mothval_sym(t->contents); }
+void mmem_persist_begin(void) { mmem_persist++; }
+void mmem_persist_end(void) { mmem_persist--; }
 
-    /* If root or sexpr, then create an empty list */
-    mothval *x = NULL;
-    if (strcmp(t->tag, ">") == 0) { x = mothval_sexpr(); }
-    if (strstr(t->tag, "sexpr")) { x = mothval_sexpr(); }
-    if (strstr(t->tag, "qexpr")) { x = mothval_qexpr(); }
+void mmem_arena_begin(void) { mmem_arena_on = 1; }
 
-    /* Fill this list with any valid expression contained within */
-    for (int i = 0; i < t->children_num; i++) {
-        if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-        if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-        if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
-        x = mothval_add(x, mothval_read(t->children[i]));
+/* Drop everything allocated in the arena, keeping one block for reuse */
+void mmem_arena_reset(void)
+{
+    mmem_arena_on = 0;
+    if (!mmem_arena) { return; }
+
+    while (mmem_arena->next) {
+        mmem_block *b = mmem_arena->next;
+        mmem_arena->next = b->next;
+        free(b);
     }
+    mmem_arena->used = 0;
+    mmem_stats.arena_resets++;
+}
 
-    return x;
+void mmem_print_stats(void)
+{
+    printf("allocations:  %ld\n", mmem_stats.allocs);
+    printf("  from slabs: %ld\n", mmem_stats.slab_allocs);
+    printf("  from arena: %ld\n", mmem_stats.arena_allocs);
+    printf("frees:        %ld\n", mmem_stats.frees);
+    printf("malloc calls: %ld\n", mmem_stats.sys_allocs);
+    printf("arena resets: %ld\n", mmem_stats.arena_resets);
 }
 
 /* Forward declare */
-void mothval_print(mothval *v);
+mothval *mgc_alloc(size_t size);
+mcells *mgc_alloc_cells(int cap);
+void mgc_remember(mothval *v);
+void mgc_remember_chunk(mchunk *c);
+void mgc_print_stats(void);
+void mvm_print_stats(void);
+void mothval_lazy_step(int work);
 
-void mothval_expr_print(mothval *v, char open, char close)
-{
-    putchar(open);
-    for (int i = 0; i < v->count; i++) {
-        mothval_print(v->cell[i]);
+/* Write barrier, run after list 'v' is given new cells, blocks or code */
+#define mgc_barrier(v) do { if (moth_gc) { mgc_remember(v); } } while (0)
 
-        /* Don't print trailing space if it's the last element */
-        if (i != (v->count - 1)) {
-            putchar(' ');
-        }
-    }
-    putchar(close);
-}
+/* Cells of dead lists freed for every value allocated with lazy freeing,
+   so that freeing keeps up with a program that makes garbage */
+#define MOTHVAL_LAZY_WORK 4
 
-mothval *mothval_pop(mothval *v, int i)
+/* Allocate a value node of 'size' bytes holding one reference */
+mothval *mothval_alloc(size_t size)
 {
-    /* Find the item at "i" */
-    mothval *x = v->cell[i];
+    if (moth_gc) { return mgc_alloc(size); }
+    if (moth_lazy_free) { mothval_lazy_step(MOTHVAL_LAZY_WORK); }
 
-    /* Shift memory after the item at "i" over the top */
-    memmove(&v->cell[i], &v->cell[i + 1],
-            sizeof(mothval *) * (v->count - i - 1));
+    mothval *v = mmem_alloc(size);
+    v->refs = 1;
+    return v;
+}
 
-    /* Decrease the count of items in the list */
-    v->count--;
+/* Create a new number type mothval */
+mothval *mothval_num(long x) {
+    if (x >= MOTHVAL_FIXNUM_MIN && x <= MOTHVAL_FIXNUM_MAX) {
+        return (mothval *)(((uintptr_t)x << 2) | MOTHVAL_FIXNUM);
+    }
 
-    /* Reallocate the memory used */
-    v->cell = realloc(v->cell, sizeof(mothval *) * v->count);
-    return x;
+    mothval *v = mothval_alloc(sizeof(mothval));
+    v->type = MOTHVAL_NUM;
+    v->num = x;
+    return v;
 }
 
-mothval *mothval_take(mothval *v, int i)
-{
-    mothval *x = mothval_pop(v, i);
-    mothval_del(v);
-    return x;
+/* Create a new error type motherr with a message of its own. Errors
+   with a fixed message are raised with mothval_error instead */
+mothval *mothval_err(const char *m) {
+    int len = strlen(m);
+    mothval *v = mothval_alloc(sizeof(mothval) + len + 1);
+    v->type = MOTHVAL_ERR;
+    v->count = len;
+    v->num = MERR_OTHER;
+    memcpy(v->err, m, len + 1);
+    return v;
 }
 
-void mothval_print(mothval *v)
+/* The message of error 'v' */
+const char *mothval_err_msg(mothval *v)
 {
-    switch (v->type) {
-    case MOTHVAL_NUM:   printf("%li", v->num); break;
-    case MOTHVAL_ERR:   printf("Error: %s", v->err); break;
-    case MOTHVAL_SYM:   printf("%s", v->sym); break;
-    case MOTHVAL_FUN:   printf("<function>"); break;
-    case MOTHVAL_SEXPR: mothval_expr_print(v, '(', ')'); break;
-    case MOTHVAL_QEXPR: mothval_expr_print(v, '{', '}'); break;
+    if (mothval_is_errcode(v)) {
+        return *(const char **)((uintptr_t)v - MOTHVAL_ERRCODE);
     }
+    return v->err;
 }
 
-mothval *mothval_copy(mothval *v)
+/* The code of error 'v', one of the MERR_ constants */
+int mothval_err_code(mothval *v)
 {
-    mothval *x = malloc(sizeof(mval));
-    x->type = v->type;
-
-    switch (v->type) {
-    /* Copy functions and numbers directly */
-    case MOTHVAL_FUN: x->fun = v->fun; break;
-    case MOTHVAL_NUM: x->num = v->num; break;
-
-    /* Copy strings */
-    case MOTHVAL_ERR:
-        x->err = malloc(strlen(v->err) + 1);
-        strcpy(x->err, v->err); break;
-
-    case MOTHVAL_SYM:
-        x->sym = malloc(strlen(v->sym) + 1);
-        strcpy(x->sym, v->sym); break;
-
-    /* Copy lists by copying each sub-expression */
-    case MOTHVAL_SEXPR:
-    case MOTHVAL_QEXPR:
-        x->count = v->count;
-        x->cell = malloc(sizeof(mothval *) * x->count);
-        for (int i = 0; i < x->count; i++) {
-            x->cell[i] = mothval_copy(v->cell[i]);
-        }
-        break;
+    if (mothval_is_errcode(v)) {
+        return (const char **)((uintptr_t)v - MOTHVAL_ERRCODE) - merror_msgs;
     }
-
-    return x;
+    return v->num;
 }
 
-void mothval_println(mothval *v) { mothval_print(v); putchar('\n'); }
-
-mothval *builtin_op(mothval *a, char *op)
+/* Create a symbol for the interned name 's' */
+mothval *mothval_symbol(msym *s)
 {
-    /* Ensure that all arguments are numbers */
-    for (int i = 0; i < a->count; i++) {
-        if (a->cell[i]->type != MOTHVAL_NUM) {
-            mothval_del(a);
-            return mothval_err("Can't operate on non-number!");
-        }
-    }
-
-    /* Pop the first element */
-    mothval *x = mothval_pop(a, 0);
-
-    /* If there are no arguments and a subtraction, perform unary negation */
-    if ((strcmp(op, "-") == 0) && a->count == 0) {
-        x->num = -x->num;
-    }
-
-    /* While there are still elements remaining */
-    while (a->count > 0) {
-        /* Pop the next element */
-        mothval *y = mothval_pop(a, 0);
-
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "/") == 0) {
-            if (y->num == 0) {
-                mothval_del(x); mothval_del(y);
-                x = mothval_err("Division by zero!"); break;
-            }
-            x->num /= y->num;
-        }
-        mothval_del(y);
-    }
-    mothval_del(a);
-    return x;
+    mothval *v = mothval_alloc(sizeof(mothval));
+    v->type = MOTHVAL_SYM;
+    v->sym = s;
+    return v;
 }
 
-mothval *builtin_add(menv *e, mval *a)
+/* Create a symbol from the 'len' characters at 's' */
+mothval *mothval_sym_len(const char *s, size_t len)
 {
-    return builtin_op(e, a, "+");
+    return mothval_symbol(msym_intern_len(s, len));
 }
 
-mothval *builtin_sub(menv *e, mval *a)
+mothval *mothval_sym(const char *s)
 {
-    return builtin_op(e, a, "-");
+    return mothval_sym_len(s, strlen(s));
 }
 
-mothval *builtin_mul(menv *e, mval *a)
+mothval *mothval_list(int type)
 {
-    return builtin_op(e, a, "*");
+    mothval *v = mothval_alloc(MOTHVAL_LIST_SIZE);
+    v->type = type;
+    v->cap = MOTHVAL_INLINE_LOG;
+    v->count = 0;
+    v->cell = mothval_inline(v);
+    v->code = NULL;
+    return v;
 }
 
-mothval *builtin_div(menv *e, mval *a)
+mothval *mothval_sexpr(void)
 {
-    return builtin_op(e, a, "/");
+    return mothval_list(MOTHVAL_SEXPR);
 }
 
-mothval *mothval_eval(mothval *v);
-mothval *builtin(mothval *a, char *func);
-
-mothval* mothval_eval_sexpr(mothval *v)
+mothval *mothval_qexpr(void)
 {
-    /* Evaluate children */
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = mothval_eval(v->cell[i]);
-    }
-
-    /* Error checking */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == MOTHVAL_ERR) { return mothval_take(v, i); }
-    }
-
-    /* Empty expression */
-    if (v->count == 0) { return v; }
-
-    /* Single expression */
-    if (v->count == 1) { return mothval_take(v, 0); }
-
-    /* Ensure that the first element is a symbol */
-    mothval *f = mothval_pop(v, 0);
-    if (f->type != MOTHVAL_SYM) {
-        mothval_del(f); mothval_del(v);
-        return mothval_err("Symbolic expression does not start with a symbol!");
-    }
-
-    /* Call builtin with operator */
-    mothval *result = builtin(v, f->sym);
-    mothval_del(f);
-    return result;
+    return mothval_list(MOTHVAL_QEXPR);
 }
 
-mothval *mothval_eval(mothval *v) {
-    /* Evaluate symbolic expressions */
-    if (v->type == MOTHVAL_SEXPR) { return mothval_eval_sexpr(v); }
-
-    /* All other mothval types remain the same */
+mothval *mothval_fun(mbuiltin func)
+{
+    mothval *v = mothval_alloc(sizeof(mothval));
+    v->type = MOTHVAL_FUN;
+    v->fun = func;
+    v->native = NULL;
     return v;
 }
 
-#define LASSERT(args, cond, err) \
-    if (!(cond)) { mothval_del(args); return mothval_err(err); }
-
-mothval* builtin_head(mothval *a)
+mothval *mothval_native(moth_builtin func)
 {
-    LASSERT(a, a->count == 1,
-            "The function 'head' passed too many arguments!");
-
-    LASSERT(a, a->cell[0]->type == MOTHVAL_QEXPR, // NOT-EQUALS?
-            "Function 'head' passed incorrect types!");
-
-    LASSERT(a, a->cell[0]->count != 0,
-            "Function 'head' passed {}!");
-
-    /* Otherwise, take first argument */
-    mothval *v = mothval_take(a, 0);
-
-    while (v->count > 1) { mothval_del(mothval_pop(v, 1)); }
+    mothval *v = mothval_fun(NULL);
+    v->native = func;
     return v;
 }
 
-mothval *builtin_tail(mothval *a)
+/* Create a lambda, which takes ownership of 'formals' and 'body' */
+mothval *mothval_lambda(mothval *formals, mothval *body)
 {
-    LASSERT(a, a->count == 1,
-            "Function 'tail' passed too many arguments! ");
-
-    LASSERT(a, a->cell[0]->type == MOTHVAL_QEXPR,
-            "Function 'tail' passed incorrect type!");
-
-    LASSERT(a, a->cell[0]->count != 0,
-            "Function 'tail' passed {}!");
-
-    /* Take first arguments */
-    mothval *v = mothval_take(a, 0);
-
-    /* Delete the first element and return */
-    mothval_del(mothval_pop(v, 0));
+    mothval *v = mothval_alloc(sizeof(mothval));
+    v->type = MOTHVAL_LAMBDA;
+    v->count = formals->count;
+    v->formals = formals;
+    v->body = body;
     return v;
 }
 
-mothval *builtin_list(mothval *a)
+/* Forward declare */
+void mothval_del(mothval *v);
+mothval *mothval_copy(mothval *v);
+mothval *mothval_share(mothval *v);
+void mchunk_release(mchunk *c);
+
+menv *menv_new(void)
 {
-    a->type = MOTHVAL_QEXPR;
-    return a;
+    static unsigned long ids = 0;
+
+    menv *e = malloc(sizeof(menv));
+    e->par = NULL;
+    e->count = 0;
+    e->cap = 0;
+    e->syms = NULL;
+    e->binds = NULL;
+    e->vals = NULL;
+    e->id = __atomic_add_fetch(&ids, 1, __ATOMIC_RELAXED);
+    e->redefs = 0;
+    e->defs = 0;
+    return e;
 }
 
-mothval *builtin_eval(mothval *a)
+/* A call frame under 'par' for lambda 'f', binding its parameters to
+   the values in 'args' and the variables it captured to theirs */
+menv *menv_frame(menv *par, mothval *f, mothval *args)
 {
-    LASSERT(a, a->count == 1,
-            "Function 'eval' passed too many arguments!");
+    mothval *formals = f->formals;
+    int captured = (formals->count - f->count) / 2;
 
-    LASSERT(a, a->cell[0]->type == MOTHVAL_QEXPR,
-            "Function 'eval' passed incorrect type!");
+    menv *e = menv_new();
+    e->par = par;
+    e->count = f->count + captured;
+    e->syms = malloc(sizeof(msym *) * e->count);
+    e->vals = malloc(sizeof(mothval *) * e->count);
 
-    mothval *x = mothval_take(a, 0);
-    x->type = MOTHVAL_SEXPR;
-    return mothval_eval(x);
+    /* The values may outlive the current line */
+    mmem_persist_begin();
+    for (int i = 0; i < e->count; i++) {
+        e->syms[i] = formals->cell[i]->sym;
+        e->vals[i] = mothval_copy(i < f->count ? args->cell[i]
+                                  : formals->cell[i + captured]);
+    }
+    mmem_persist_end();
+
+    return e;
 }
 
-mothval *mothval_join(mothval *x, mothval *y)
+void menv_del(menv *e)
 {
-    /* For each cell in 'y', add it to 'x' */
-    while (y->count) {
-        x = mothval_add(x, mothval_pop(y, 0));
+    /* The symbols are interned and outlive the environment */
+    if (e->par) {
+        for (int i = 0; i < e->count; i++) { mothval_del(e->vals[i]); }
     }
-
-    /* Delete the empty 'y' and return 'x' */
-    mothval_del(y);
-    return x;
+    for (int i = 0; i < e->cap; i++) {
+        if (!e->syms[i]) { continue; }
+        if (e->binds[i]->val) { mothval_del(e->binds[i]->val); }
+        free(e->binds[i]);
+    }
+    free(e->syms);
+    free(e->binds);
+    free(e->vals);
+    free(e);
 }
 
-mothval *builtin_join(mothval *a)
+/* Find the slot holding 's', or the empty slot where it would go */
+int menv_slot(menv *e, msym *s)
 {
-    for (int i = 0; i < a->count; i++) {
-        LASSERT(a, a->cell[i]->type == MOTHVAL_QEXPR,
-                "Function 'join' passed incorrect type!");
+    unsigned long i = s->hash & (e->cap - 1);
+    while (e->syms[i] && e->syms[i] != s) {
+        i = (i + 1) & (e->cap - 1);
     }
+    return i;
+}
 
-    mothval *x = mothval_pop(a, 0);
+void menv_grow(menv *e)
+{
+    menv old = *e;
+    e->cap = old.cap ? old.cap * 2 : 16;
+    e->syms = calloc(e->cap, sizeof(msym *));
+    e->binds = calloc(e->cap, sizeof(mbind *));
 
-    while (a->count) {
-        x = mothval_join(x, mothval_pop(a, 0));
+    /* Rehash every binding into the bigger table */
+    for (int i = 0; i < old.cap; i++) {
+        if (!old.syms[i]) { continue; }
+        int j = menv_slot(e, old.syms[i]);
+        e->syms[j] = old.syms[i];
+        e->binds[j] = old.binds[i];
     }
 
-    mothval_del(a);
-    return x;
+    free(old.syms);
+    free(old.binds);
 }
 
-mothval *builtin(mothval *a, char *func)
+/* The binding of 's' in global environment 'e', which is created
+   without a value if there is none yet */
+mbind *menv_bind(menv *e, msym *s)
 {
-    if (strcmp("list", func) == 0) { return builtin_list(a); }
-    if (strcmp("head", func) == 0) { return builtin_head(a); }
-    if (strcmp("tail", func) == 0) { return builtin_tail(a); }
-    if (strcmp("join", func) == 0) { return builtin_join(a); }
-    if (strcmp("eval", func) == 0) { return builtin_eval(a); }
-    if (strstr("+-/*", func)) { return builtin_op(a, func); }
-    mothval_del(a);
-    return mothval_err("Unknown function!");
+    /* Grow by doubling so that definitions cost amortized O(1) and the
+       load factor stays under 3/4 */
+    if ((e->count + 1) * 4 > e->cap * 3) { menv_grow(e); }
+
+    int i = menv_slot(e, s);
+    if (!e->syms[i]) {
+        e->syms[i] = s;
+        e->binds[i] = malloc(sizeof(mbind));
+        e->binds[i]->sym = s;
+        e->binds[i]->val = NULL;
+        e->count++;
+    }
+    return e->binds[i];
+}
+
+/* Return a copy of the value bound to 's' in the innermost environment
+   that has it */
+mothval *menv_lookup(menv *e, msym *s)
+{
+    for (; e->par; e = e->par) {
+        for (int i = 0; i < e->count; i++) {
+            if (e->syms[i] == s) { return mothval_copy(e->vals[i]); }
+        }
+    }
+
+    mothval *x = mothval_error(MERR_UNBOUND);
+    mpar_lock_begin();
+    if (e->count > 0) {
+        int i = menv_slot(e, s);
+        if (e->syms[i] && e->binds[i]->val) {
+            x = mothval_copy(e->binds[i]->val);
+        }
+    }
+    mpar_lock_end();
+    return x;
+}
+
+mothval *menv_get(menv *e, mothval *k)
+{
+    return menv_lookup(e, k->sym);
+}
+
+/* The global environment that 'e' is a frame of */
+menv *menv_root(menv *e)
+{
+    while (e->par) { e = e->par; }
+    return e;
+}
+
+/* Bind 'k' to a copy of 'v' in global environment 'e' */
+void menv_put(menv* e, mothval *k, mothval *v)
+{
+    mbind *b = menv_bind(e, k->sym);
+
+    /* The binding outlives the current line */
+    mmem_persist_begin();
+
+    /* If the variable already exists, replace its value with a copy of
+       the one supplied by the user */
+    mothval *x = mothval_copy(v);
+    if (b->val) {
+        if (mothval_type(b->val) == MOTHVAL_FUN) { e->redefs++; }
+        mothval_del(b->val);
+    }
+    b->val = x;
+    e->defs++;
+
+    mmem_persist_end();
+}
+
+/* Size in bytes of a block with room for 1 << 'cap' cells */
+#define MCELLS_SIZE(cap) (sizeof(mcells) + (sizeof(mothval *) << (cap)))
+
+/* Size in bytes of the node of 'v' */
+size_t mothval_size(mothval *v)
+{
+    switch (v->type) {
+    case MOTHVAL_ERR: return sizeof(mothval) + v->count + 1;
+    case MOTHVAL_QEXPR:
+    case MOTHVAL_SEXPR: return MOTHVAL_LIST_SIZE;
+    }
+    return sizeof(mothval);
+}
+
+/*
+ * Freeing lists
+ *
+ * A list whose last reference goes is pushed onto a stack of dead lists,
+ * and mothval_lazy_step deletes their cells, last cell first. A cell
+ * that is itself a list is pushed in the same way rather than freed by
+ * recursion, so nesting of any depth can be freed.
+ *
+ * Normally the stack is emptied before mothval_del returns. With -l it
+ * is not: dropping a structure of any size takes constant time and the
+ * work of freeing it is spread a few cells at a time over later
+ * allocations and the time between REPL lines.
+ */
+
+static _Thread_local mothval **mothval_dead = NULL;
+static _Thread_local int mothval_dead_count = 0;
+static _Thread_local int mothval_dead_cap = 0;
+
+/* Set while the stack is being emptied, so that nested deletes only push */
+static _Thread_local int mothval_freeing = 0;
+
+static _Thread_local long mothval_lazy_frees = 0;
+static _Thread_local double mothval_lazy_max_pause = 0;
+
+/* Queue dead list 'v' for freeing. Its window is widened to every cell
+   it has to delete, and a shared block is simply let go */
+void mothval_defer(mothval *v)
+{
+    if (!mothval_is_inline(v)) {
+        mcells *b = mothval_block(v);
+        if (mref_dec(b->refs) > 0) {
+            v->cell = mothval_inline(v);
+            v->count = 0;
+        } else {
+            v->cell = b->items + b->lo;
+            v->count = b->hi - b->lo;
+        }
+    }
+
+    if (mothval_dead_count == mothval_dead_cap) {
+        mothval_dead_cap = mothval_dead_cap ? mothval_dead_cap * 2 : 256;
+        mothval_dead = realloc(mothval_dead, sizeof(mothval *) * mothval_dead_cap);
+    }
+    mothval_dead[mothval_dead_count++] = v;
+}
+
+/* Bytes of a big block that lazy freeing gives back at a time, and the
+   units of work that takes: unmapping memory costs about as much as
+   deleting a cell for every 2 KB of it */
+#define MOTHVAL_LAZY_PIECE 65536
+#define MOTHVAL_LAZY_PIECE_WORK 32
+
+/* Do up to 'work' deletions or frees from the dead lists */
+void mothval_lazy_step(int work)
+{
+    while (work-- > 0 && mothval_dead_count) {
+        mothval *v = mothval_dead[mothval_dead_count - 1];
+
+        if (v->count > 0) {
+            mothval_del(v->cell[--v->count]);
+            continue;
+        }
+
+        /* Unmapping a big block at once takes as long as it is big, so
+           with -l it goes back a piece per unit, last first. Its 'lo' is
+           set to -1 once that starts, and 'hi' counts the pieces kept */
+        size_t size = MCELLS_SIZE(v->cap);
+        if (moth_lazy_free && !mothval_is_inline(v) && size >= MMEM_MAP_MIN) {
+            mcells *b = mothval_block(v);
+            if (b->lo >= 0) {
+                b->lo = -1;
+                b->hi = (int)((size - 1) / MOTHVAL_LAZY_PIECE) + 1;
+            }
+            size_t from = (size_t)--b->hi * MOTHVAL_LAZY_PIECE;
+            size_t to = from + MOTHVAL_LAZY_PIECE < size
+                      ? from + MOTHVAL_LAZY_PIECE : size;
+            mmem_unmap(b, from, to);
+            work -= MOTHVAL_LAZY_PIECE_WORK - 1;
+            if (from > 0) { continue; }
+            mmem_stats.frees++;
+            v->cell = mothval_inline(v);
+        }
+
+        mothval_dead_count--;
+        mothval_lazy_frees++;
+        if (!mothval_is_inline(v)) {
+            mmem_free(mothval_block(v), MCELLS_SIZE(v->cap));
+        }
+        mchunk_release(v->code);
+        mmem_free(v, MOTHVAL_LIST_SIZE);
+    }
+}
+
+/* Free dead lists for up to 'budget' milliseconds, or until there are
+   none left if it is negative */
+void mothval_lazy_drain(double budget)
+{
+    double start = moth_now();
+    double step = 0;
+    while (mothval_dead_count) {
+        /* Stop once another step like the last would run over, leaving
+           the same again for one that takes longer */
+        double now = moth_now();
+        if (budget >= 0 && now - start + 2 * step > budget) { break; }
+        mothval_lazy_step(256);
+        step = moth_now() - now;
+    }
+
+    double pause = moth_now() - start;
+    if (pause > mothval_lazy_max_pause) { mothval_lazy_max_pause = pause; }
+}
+
+void mothval_lazy_print_stats(void)
+{
+    printf("lazy frees:   %ld\n", mothval_lazy_frees);
+    printf("dead lists:   %d\n", mothval_dead_count);
+    printf("max pause:    %.3f ms\n", mothval_lazy_max_pause);
+}
+
+void mothval_del(mothval *v)
+{
+    /* The collector frees whatever is no longer reachable */
+    if (moth_gc || mothval_is_imm(v)) { return; }
+
+    /* Only free the value when the last reference goes */
+    if (mref_dec(v->refs) > 0) { return; }
+
+    switch (v->type) {
+    case MOTHVAL_NUM: break;
+
+    /* The message is freed with the node */
+    case MOTHVAL_ERR:
+        mmem_free(v, sizeof(mothval) + v->count + 1);
+        return;
+
+    /* Symbols are interned and never freed */
+    case MOTHVAL_SYM: break;
+
+    case MOTHVAL_FUN: break;
+
+    case MOTHVAL_LAMBDA:
+        mothval_del(v->formals);
+        mothval_del(v->body);
+        break;
+
+    /* If Qexpr or Sexpr, delete all elements inside */
+    case MOTHVAL_QEXPR:
+    case MOTHVAL_SEXPR:
+        mothval_defer(v);
+        if (!moth_lazy_free && !mothval_freeing) {
+            mothval_freeing = 1;
+            mothval_lazy_step(INT_MAX);
+            mothval_freeing = 0;
+        }
+        return;
+    }
+
+    mmem_free(v, sizeof(mothval));
+}
+
+/* Drop the compiled form of a list that is about to change */
+void mothval_uncompile(mothval *v)
+{
+    mchunk_release(v->code);
+    v->code = NULL;
+}
+
+/* Move the cells of list 'v' into a new block with room for 1 << 'cap'
+   cells. Cells in a shared block are copied, since it still owns them */
+void mothval_rehome(mothval *v, int cap)
+{
+    mcells *b = moth_gc ? mgc_alloc_cells(cap) : mmem_alloc(MCELLS_SIZE(cap));
+    b->refs = 1;
+    b->lo = 0;
+    b->hi = v->count;
+    b->cap = cap;
+
+    if (mothval_shared(v)) {
+        for (int i = 0; i < v->count; i++) {
+            b->items[i] = mothval_copy(v->cell[i]);
+        }
+
+        /* Another thread may have let go of the old block meanwhile */
+        mcells *old = mothval_block(v);
+        if (mref_dec(old->refs) == 0 && !moth_gc) {
+            for (int i = old->lo; i < old->hi; i++) { mothval_del(old->items[i]); }
+            mmem_free(old, MCELLS_SIZE(v->cap));
+        }
+    } else {
+        memcpy(b->items, v->cell, sizeof(mothval *) * v->count);
+
+        /* The collector frees the old block once it is unreachable */
+        if (!moth_gc && !mothval_is_inline(v)) {
+            mmem_free(mothval_block(v), MCELLS_SIZE(v->cap));
+        }
+    }
+
+    v->cap = cap;
+    v->cell = b->items;
+    mothval_block(v) = b;
+    mgc_barrier(v);
+}
+
+/* Make the cells of list 'v' its own before they are changed. A shared
+   block is copied, and an unshared one drops any values outside the
+   window that other lists left behind */
+void mothval_own(mothval *v)
+{
+    if (mothval_is_inline(v)) { return; }
+
+    if (mothval_shared(v)) {
+        mothval_rehome(v, v->cap);
+        return;
+    }
+
+    mcells *b = mothval_block(v);
+    int lo = v->cell - b->items;
+    for (int i = b->lo; i < lo; i++) { mothval_del(b->items[i]); }
+    for (int i = lo + v->count; i < b->hi; i++) { mothval_del(b->items[i]); }
+    b->lo = lo;
+    b->hi = lo + v->count;
+}
+
+/* Make list 'v' its own with room for at least 'n' cells in total,
+   doubling its capacity so that a run of appends costs amortized O(1)
+   each */
+void mothval_reserve(mothval *v, int n)
+{
+    mothval_own(v);
+
+    int room = mothval_is_inline(v) ? MOTHVAL_INLINE
+        : (1 << v->cap) - (v->cell - mothval_block(v)->items);
+    if (n <= room) { return; }
+
+    int cap = MOTHVAL_INLINE_LOG;
+    while (n > 1 << cap) { cap++; }
+    mothval_rehome(v, cap);
+}
+
+/* Append the 'n' values at 'x' to list 'v', which takes ownership */
+void mothval_append(mothval *v, mothval **x, int n)
+{
+    mothval_uncompile(v);
+    mothval_reserve(v, v->count + n);
+    memcpy(&v->cell[v->count], x, sizeof(mothval *) * n);
+    v->count += n;
+    if (!mothval_is_inline(v)) { mothval_block(v)->hi += n; }
+    mgc_barrier(v);
+}
+
+mothval *mothval_add(mothval *v, mothval *x)
+{
+    mothval_append(v, &x, 1);
+    return v;
+}
+
+/* Empty list 'v' without deleting its cells, which have been moved
+   elsewhere. The list must own its cells */
+void mothval_forget(mothval *v)
+{
+    if (!mothval_is_inline(v)) {
+        mcells *b = mothval_block(v);
+        b->lo = b->hi = v->cell - b->items;
+    }
+    v->count = 0;
+}
+
+/* Keep only the first 'n' cells of list 'v' */
+void mothval_truncate(mothval *v, int n)
+{
+    mothval_uncompile(v);
+
+    /* Cells past the end of a shared window stay with the block */
+    if (!mothval_shared(v)) {
+        mothval_own(v);
+        for (int i = n; i < v->count; i++) {
+            mothval_del(v->cell[i]);
+        }
+        if (!mothval_is_inline(v)) { mothval_block(v)->hi -= v->count - n; }
+    }
+    v->count = n;
+}
+
+/* Remove the first 'n' cells of list 'v' */
+void mothval_drop(mothval *v, int n)
+{
+    mothval_uncompile(v);
+
+    /* Cells before the start of a shared window stay with the block */
+    if (!mothval_shared(v)) {
+        mothval_own(v);
+        for (int i = 0; i < n; i++) {
+            mothval_del(v->cell[i]);
+        }
+        if (mothval_is_inline(v)) {
+            memmove(v->cell, &v->cell[n], sizeof(mothval *) * (v->count - n));
+            v->count -= n;
+            return;
+        }
+        mothval_block(v)->lo += n;
+    }
+    v->cell += n;
+    v->count -= n;
+}
+
+/*
+ * Reader
+ *
+ * Source is read in a single pass over the characters, without
+ * recursion: a list being read stays open on a stack until its closing
+ * bracket, so nesting is limited only by memory. The grammar is
+ *
+ *   number : /-?[0-9]+/
+ *   symbol : /[a-zA-Z0-9_+\-*\/\\=<>!&]+/
+ *   sexpr  : '(' <expr>* ')'
+ *   qexpr  : '{' <expr>* '}'
+ *   expr   : <number> | <symbol> | <sexpr> | <qexpr>
+ *   moth   : <expr>*
+ *
+ * with whitespace allowed between expressions, and a number taking
+ * precedence over a symbol where both match.
+ */
+
+/* Whether 'c' can be part of a symbol */
+int mothval_read_symch(char c)
+{
+    return c != '\0' && (isalnum((unsigned char)c) || strchr("_+-*/\\=<>!&", c));
+}
+
+mothval *mothval_read_num(const char *s, const char **end)
+{
+    char *e;
+    errno = 0;
+    long x = strtol(s, &e, 10);
+    *end = e;
+    return errno != ERANGE ? mothval_num(x) : mothval_error(MERR_BAD_NUMBER);
+}
+
+/* Read every expression in 's' into an S-Expression, or return the
+   first syntax error */
+mothval *mothval_read(const char *s)
+{
+    /* Lists still waiting for their closing bracket, innermost last.
+       Each is already added to the one below, so deleting the bottom
+       one cleans up after an error. 'at' has the line and column of
+       each one's opening bracket */
+    int n = 1, cap = 16;
+    mothval **open = malloc(sizeof(mothval *) * cap);
+    int *at = malloc(sizeof(int) * 2 * cap);
+    open[0] = mothval_sexpr();
+
+    int line = 1;
+    const char *bol = s;
+
+    while (*s) {
+        mothval *top = open[n - 1];
+        char c = *s;
+
+        if (c == '\n') { line++; bol = ++s; continue; }
+        if (isspace((unsigned char)c)) { s++; continue; }
+
+        if (isdigit((unsigned char)c)
+            || (c == '-' && isdigit((unsigned char)s[1]))) {
+            mothval_add(top, mothval_read_num(s, &s));
+            continue;
+        }
+
+        if (mothval_read_symch(c)) {
+            const char *start = s;
+            while (mothval_read_symch(*s)) { s++; }
+            mothval_add(top, mothval_sym_len(start, s - start));
+            continue;
+        }
+
+        if (c == '(' || c == '{') {
+            mothval *x = c == '(' ? mothval_sexpr() : mothval_qexpr();
+            mothval_add(top, x);
+            if (n == cap) {
+                cap *= 2;
+                open = realloc(open, sizeof(mothval *) * cap);
+                at = realloc(at, sizeof(int) * 2 * cap);
+            }
+            at[2 * n] = line;
+            at[2 * n + 1] = (int)(s - bol) + 1;
+            open[n++] = x;
+            s++;
+            continue;
+        }
+
+        /* A closing bracket has to match the innermost open list */
+        char close = top->type == MOTHVAL_SEXPR ? ')' : '}';
+        if (n == 1 || c != close) { break; }
+        n--;
+        s++;
+    }
+
+    mothval *x = open[0];
+    if (*s || n > 1) {
+        char msg[64];
+        if (*s) {
+            snprintf(msg, sizeof(msg), "%d:%d: unexpected '%c'",
+                     line, (int)(s - bol) + 1, *s);
+        } else {
+            /* The input ended inside a list: point at where it opened */
+            snprintf(msg, sizeof(msg), "%d:%d: '%c' is not closed",
+                     at[2 * n - 2], at[2 * n - 1],
+                     open[n - 1]->type == MOTHVAL_SEXPR ? '(' : '{');
+        }
+        mothval_del(x);
+        x = mothval_err(msg);
+        x->num = MERR_SYNTAX;
+    }
+
+    free(open);
+    free(at);
+    return x;
+}
+
+mothval *mothval_pop(mothval *v, int i)
+{
+    /* The popped item is handed to the caller, so it can't be shared */
+    mothval_uncompile(v);
+    mothval_own(v);
+
+    /* Find the item at "i" */
+    mothval *x = v->cell[i];
+
+    if (i == 0 && !mothval_is_inline(v)) {
+        /* Popping the front of a block just moves the window */
+        v->cell++;
+        mothval_block(v)->lo++;
+    } else {
+        /* Shift memory after the item at "i" over the top */
+        memmove(&v->cell[i], &v->cell[i + 1],
+                sizeof(mothval *) * (v->count - i - 1));
+        if (!mothval_is_inline(v)) { mothval_block(v)->hi--; }
+    }
+
+    /* Decrease the count of items in the list, keeping its capacity */
+    v->count--;
+    return x;
+}
+
+mothval *mothval_take(mothval *v, int i)
+{
+    mothval *x = mothval_pop(v, i);
+    mothval_del(v);
+    return x;
+}
+
+/* A list or lambda part way through being printed. 'i' is the next
+   cell, or for a lambda the next parameter, followed by its body */
+typedef struct {
+    mothval *v;
+    int i;
+} mprint_frame;
+
+static _Thread_local mprint_frame *mprint_stack = NULL;
+static _Thread_local int mprint_cap = 0;
+
+void mothval_print(mothval *v)
+{
+    int n = 0;
+
+    for (;;) {
+        /* Print an atom, or open a list or lambda to print its parts */
+        switch (mothval_type(v)) {
+        case MOTHVAL_NUM:    printf("%li", mothval_to_num(v)); break;
+        case MOTHVAL_ERR:    printf("Error: %s", mothval_err_msg(v)); break;
+        case MOTHVAL_SYM:    printf("%s", v->sym->name); break;
+        case MOTHVAL_FUN:    printf("<function>"); break;
+        case MOTHVAL_LAMBDA: printf("(\\ "); break;
+        case MOTHVAL_SEXPR:  putchar('('); break;
+        case MOTHVAL_QEXPR:  putchar('{'); break;
+        }
+
+        if (!mothval_is_imm(v) && (v->type == MOTHVAL_LAMBDA
+            || v->type == MOTHVAL_SEXPR || v->type == MOTHVAL_QEXPR)) {
+            if (n == mprint_cap) {
+                mprint_cap = mprint_cap ? mprint_cap * 2 : 64;
+                mprint_stack = realloc(mprint_stack,
+                                       sizeof(mprint_frame) * mprint_cap);
+            }
+            mprint_stack[n].v = v;
+            mprint_stack[n].i = 0;
+            n++;
+        }
+
+        /* Close whatever is finished and move on to the next value */
+        v = NULL;
+        while (n > 0 && !v) {
+            mprint_frame *f = &mprint_stack[n - 1];
+
+            if (f->v->type == MOTHVAL_LAMBDA) {
+                /* What a closure captured is not part of how it was
+                   written, so only its parameters are printed */
+                int i = f->i++;
+                if (i == 0) { putchar('{'); }
+                if (i < f->v->count) {
+                    if (i > 0) { putchar(' '); }
+                    v = f->v->formals->cell[i];
+                } else if (i == f->v->count) {
+                    printf("} ");
+                    v = f->v->body;
+                } else {
+                    putchar(')');
+                    n--;
+                }
+            } else if (f->i < f->v->count) {
+                /* Don't print a space before the first element */
+                if (f->i > 0) { putchar(' '); }
+                v = f->v->cell[f->i++];
+            } else {
+                putchar(f->v->type == MOTHVAL_SEXPR ? ')' : '}');
+                n--;
+            }
+        }
+
+        if (!v) { break; }
+    }
+}
+
+/* Forward declare */
+mchunk *mchunk_retain(mchunk *c);
+
+mothval *mothval_copy_list(mothval *v, int deep);
+
+/* Copy the node of 'v'. The copy references the same elements */
+mothval *mothval_dup(mothval *v)
+{
+    /* Immediate numbers and errors are their own copy */
+    if (mothval_is_imm(v)) { return v; }
+
+    /* Errors carry their message inline */
+    if (v->type == MOTHVAL_ERR) {
+        mothval *x = mothval_alloc(sizeof(mothval) + v->count + 1);
+        x->type = MOTHVAL_ERR;
+        x->count = v->count;
+        x->num = v->num;
+        memcpy(x->err, v->err, v->count + 1);
+        return x;
+    }
+
+    if (v->type == MOTHVAL_SEXPR || v->type == MOTHVAL_QEXPR) {
+        /* Copy small lists by referencing each sub-expression */
+        if (mothval_is_inline(v) || mmem_outlived(mothval_block(v))) {
+            return mothval_copy_list(v, 0);
+        }
+
+        /* Larger ones share their block until either side changes */
+        mothval *x = mothval_list(v->type);
+        x->cap = v->cap;
+        x->cell = v->cell;
+        x->count = v->count;
+        mothval_block(x) = mothval_block(v);
+        mref_inc(mothval_block(x)->refs);
+
+        /* The copy has the same cells, so it can share the bytecode */
+        x->code = mchunk_retain(v->code);
+        mgc_barrier(x);
+        return x;
+    }
+
+    mothval *x = mothval_alloc(sizeof(mothval));
+    x->type = v->type;
+
+    switch (v->type) {
+    /* Copy functions, numbers and interned symbols directly */
+    case MOTHVAL_FUN:
+        x->fun = v->fun;
+        x->native = v->native;
+        break;
+    case MOTHVAL_LAMBDA:
+        x->count = v->count;
+        x->formals = mothval_copy(v->formals);
+        x->body = mothval_copy(v->body);
+        break;
+    case MOTHVAL_NUM: x->num = v->num; break;
+    case MOTHVAL_SYM: x->sym = v->sym; break;
+    }
+
+    return x;
+}
+
+/* Copy 'v' and everything in it */
+mothval *mothval_deep_copy(mothval *v)
+{
+    if (mothval_type(v) != MOTHVAL_SEXPR && mothval_type(v) != MOTHVAL_QEXPR) {
+        return mothval_dup(v);
+    }
+    return mothval_copy_list(v, 1);
+}
+
+/* Whether copying cell 'c' of a list means copying its cells too,
+   rather than taking another reference to it */
+static int mothval_copy_descends(mothval *c, int deep)
+{
+    if (mothval_type(c) != MOTHVAL_SEXPR && mothval_type(c) != MOTHVAL_QEXPR) {
+        return 0;
+    }
+    if (deep) { return 1; }
+    if (moth_gc) { return 0; }
+    return mref_get(c->refs) == MOTHVAL_MAX_REFS || mmem_outlived(c);
+}
+
+/* A list part way through being copied: cells of 'v' before 'i' have
+   been copied into 'x' */
+typedef struct {
+    mothval *v;
+    mothval *x;
+    int i;
+} mcopy_frame;
+
+static _Thread_local mcopy_frame *mcopy_stack = NULL;
+static _Thread_local int mcopy_count = 0;
+static _Thread_local int mcopy_cap = 0;
+
+/* Copy list 'v' into a new node with its own cells. Each cell is copied
+   as mothval_copy would, or everything in it as well if 'deep' is set.
+   Lists within lists are copied from a stack rather than by recursion */
+mothval *mothval_copy_list(mothval *v, int deep)
+{
+    /* A lambda's copy can copy its formals and body from in here, so
+       this run only uses the frames above where it started */
+    int base = mcopy_count;
+
+    for (;;) {
+        /* Start copying 'v' */
+        if (v) {
+            if (mcopy_count == mcopy_cap) {
+                mcopy_cap = mcopy_cap ? mcopy_cap * 2 : 64;
+                mcopy_stack = realloc(mcopy_stack, sizeof(mcopy_frame) * mcopy_cap);
+            }
+            mcopy_frame *f = &mcopy_stack[mcopy_count++];
+            f->v = v;
+            f->x = mothval_list(v->type);
+            f->i = 0;
+            mothval_reserve(f->x, v->count);
+            v = NULL;
+        }
+
+        mcopy_frame *f = &mcopy_stack[mcopy_count - 1];
+
+        if (f->i < f->v->count) {
+            mothval *c = f->v->cell[f->i++];
+            if (!mothval_copy_descends(c, deep)) {
+                c = mothval_copy(c);
+                mothval_append(f->x, &c, 1);
+            } else if (!deep && !mothval_is_inline(c)
+                       && !mmem_outlived(mothval_block(c))) {
+                /* Its block can be shared without copying the cells */
+                c = mothval_dup(c);
+                mothval_append(f->x, &c, 1);
+            } else {
+                v = c;
+            }
+            continue;
+        }
+
+        /* The copy has the same cells, so it can share the bytecode */
+        mothval *x = f->x;
+        x->code = mchunk_retain(f->v->code);
+        mgc_barrier(x);
+
+        if (--mcopy_count == base) { return x; }
+        mothval_append(mcopy_stack[mcopy_count - 1].x, &x, 1);
+    }
+}
+
+/* Return another reference to 'v' */
+mothval *mothval_copy(mothval *v)
+{
+    if (mothval_is_imm(v)) { return v; }
+    if (moth_deep_copy) { return mothval_deep_copy(v); }
+    return mothval_share(v);
+}
+
+/* Return another reference to 'v', even with -d */
+mothval *mothval_share(mothval *v)
+{
+    if (mothval_is_imm(v)) { return v; }
+
+    /* Without reference counts every reference is the value itself */
+    if (moth_gc) { return v; }
+
+    /* A value in the line arena can only outlive it as a copy */
+    if (mref_get(v->refs) == MOTHVAL_MAX_REFS || mmem_outlived(v)) {
+        return mothval_dup(v);
+    }
+
+    mref_inc(v->refs);
+    return v;
+}
+
+/* Return 'v' if this is its only reference, and otherwise a copy of it
+   that can be changed. Takes over the caller's reference to 'v'. The
+   collector does not count references, so it always gets a copy */
+mothval *mothval_unshare(mothval *v)
+{
+    if (mothval_is_imm(v) || (!moth_gc && mref_get(v->refs) == 1)) { return v; }
+
+    mothval *x = mothval_dup(v);
+    mothval_del(v);
+    return x;
+}
+
+void mothval_println(mothval *v) { mothval_print(v); putchar('\n'); }
+
+/* Forward declare */
+mothval *moth_eval(menv *e, mothval *v);
+
+#define LASSERT(args, cond, code) \
+    if (!(cond)) { mothval_del(args); return mothval_error(code); }
+
+/* Tail calls
+ *
+ * A builtin whose result is the value of another expression, like
+ * 'eval' and 'if', and a lambda call, whose result is the value of its
+ * body, do not evaluate it themselves. They leave the expression and
+ * the environment to evaluate it in here and return MOTHVAL_TAIL, and
+ * the evaluator runs it in place of the call. A call in tail position
+ * therefore does not grow the C stack, and a loop written as tail
+ * recursion runs in constant memory.
+ */
+
+static mothval mothval_tail_marker;
+#define MOTHVAL_TAIL (&mothval_tail_marker)
+
+/* The list whose cells are evaluated, the environment to evaluate them
+   in, and whether that is a new call frame */
+static _Thread_local mothval *mtail_expr;
+static _Thread_local menv *mtail_env;
+static _Thread_local int mtail_frame;
+
+/* Have the evaluator evaluate the cells of list 'x' in 'e' as the result
+   of the current call */
+mothval *moth_tail(menv *e, mothval *x, int frame)
+{
+    mtail_expr = x;
+    mtail_env = e;
+    mtail_frame = frame;
+    return MOTHVAL_TAIL;
+}
+
+/* Call builtin 'f', registered through moth.h, which only borrows the
+   arguments in 'a' */
+static mothval *mothval_call_native(moth_builtin f, mothval *a)
+{
+    mothval *x = f(a);
+    mothval_del(a);
+    return x ? x : mothval_sexpr();
+}
+
+/* Apply function 'f' to the arguments in 'a', which it takes over. The
+   result may be MOTHVAL_TAIL */
+mothval *mothval_call(menv *e, mothval *f, mothval *a)
+{
+    if (f->type == MOTHVAL_FUN) {
+        return f->native ? mothval_call_native(f->native, a) : f->fun(e, a);
+    }
+
+    LASSERT(a, a->count == f->count, MERR_CALL_ARGS);
+
+    /* Bind each argument to its parameter in a new frame */
+    menv *frame = menv_frame(menv_root(e), f, a);
+    mothval_del(a);
+
+    return moth_tail(frame, mothval_copy(f->body), 1);
+}
+
+mothval *builtin_op(menv *e, mothval *a, char op)
+{
+    /* Ensure that all arguments are numbers */
+    for (int i = 0; i < a->count; i++) {
+        if (mothval_type(a->cell[i]) != MOTHVAL_NUM) {
+            mothval_del(a);
+            return mothval_error(MERR_OP_TYPE);
+        }
+    }
+
+    /* Accumulate into a plain long, starting from the first element */
+    long x = mothval_to_num(a->cell[0]);
+    int over = 0;
+
+    /* If there are no arguments and a subtraction, perform unary negation */
+    if (op == '-' && a->count == 1) {
+        over = __builtin_sub_overflow(0, x, &x);
+    }
+
+    /* Fold in each of the remaining elements. A result that does not fit
+       in a long is an error, as is dividing LONG_MIN by -1, which traps */
+    for (int i = 1; !over && i < a->count; i++) {
+        long y = mothval_to_num(a->cell[i]);
+
+        switch (op) {
+        case '+': over = __builtin_add_overflow(x, y, &x); break;
+        case '-': over = __builtin_sub_overflow(x, y, &x); break;
+        case '*': over = __builtin_mul_overflow(x, y, &x); break;
+        case '/':
+            if (y == 0) {
+                mothval_del(a);
+                return mothval_error(MERR_DIV_ZERO);
+            }
+            over = x == LONG_MIN && y == -1;
+            if (!over) { x /= y; }
+            break;
+        }
+    }
+    mothval_del(a);
+    return over ? mothval_error(MERR_OVERFLOW) : mothval_num(x);
+}
+
+mothval *builtin_add(menv *e, mothval *a)
+{
+    return builtin_op(e, a, '+');
+}
+
+mothval *builtin_sub(menv *e, mothval *a)
+{
+    return builtin_op(e, a, '-');
+}
+
+mothval *builtin_mul(menv *e, mothval *a)
+{
+    return builtin_op(e, a, '*');
+}
+
+mothval *builtin_div(menv *e, mothval *a)
+{
+    return builtin_op(e, a, '/');
+}
+
+mothval* builtin_head(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 1, MERR_HEAD_ARGS);
+
+    LASSERT(a, mothval_type(a->cell[0]) == MOTHVAL_QEXPR, // NOT-EQUALS?
+            MERR_HEAD_TYPE);
+
+    LASSERT(a, a->cell[0]->count != 0, MERR_HEAD_EMPTY);
+
+    /* Otherwise, take first argument */
+    mothval *v = mothval_unshare(mothval_take(a, 0));
+
+    mothval_truncate(v, 1);
+    return v;
+}
+
+mothval *builtin_tail(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 1, MERR_TAIL_ARGS);
+
+    LASSERT(a, mothval_type(a->cell[0]) == MOTHVAL_QEXPR, MERR_TAIL_TYPE);
+
+    LASSERT(a, a->cell[0]->count != 0, MERR_TAIL_EMPTY);
+
+    /* Take first arguments */
+    mothval *v = mothval_unshare(mothval_take(a, 0));
+
+    /* Drop the first element and return */
+    mothval_drop(v, 1);
+    return v;
+}
+
+mothval *builtin_list(menv *e, mothval *a)
+{
+    a->type = MOTHVAL_QEXPR;
+    return a;
+}
+
+mothval *builtin_eval(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 1, MERR_EVAL_ARGS);
+
+    LASSERT(a, mothval_type(a->cell[0]) == MOTHVAL_QEXPR, MERR_EVAL_TYPE);
+
+    mothval *x = mothval_unshare(mothval_take(a, 0));
+    x->type = MOTHVAL_SEXPR;
+    return moth_tail(e, x, 0);
+}
+
+mothval *mothval_join(mothval *x, mothval *y)
+{
+    /* Move all the cells of 'y' to the end of 'x' in one go */
+    y = mothval_unshare(y);
+    mothval_own(y);
+    mothval_append(x, y->cell, y->count);
+
+    /* Delete the empty 'y' and return 'x' */
+    mothval_forget(y);
+    mothval_del(y);
+    return x;
+}
+
+mothval *builtin_join(menv *e, mothval *a)
+{
+    for (int i = 0; i < a->count; i++) {
+        LASSERT(a, mothval_type(a->cell[i]) == MOTHVAL_QEXPR, MERR_JOIN_TYPE);
+    }
+
+    /* Size the result once, then append each list to the first */
+    mothval_own(a);
+    mothval *x = mothval_unshare(a->cell[0]);
+    int total = 0;
+    for (int i = 0; i < a->count; i++) { total += a->cell[i]->count; }
+    mothval_reserve(x, total);
+
+    for (int i = 1; i < a->count; i++) {
+        x = mothval_join(x, a->cell[i]);
+    }
+
+    mothval_forget(a);
+    mothval_del(a);
+    return x;
+}
+
+/* Lists waiting to be searched by mothval_mentions */
+static _Thread_local mothval **mscan_stack = NULL;
+static _Thread_local int mscan_cap = 0;
+
+/* Whether symbol 's' appears anywhere in list 'v' */
+int mothval_mentions(mothval *v, msym *s)
+{
+    int n = 0;
+    for (;;) {
+        for (int i = 0; i < v->count; i++) {
+            mothval *c = v->cell[i];
+            int t = mothval_type(c);
+            if (t == MOTHVAL_SYM && c->sym == s) { return 1; }
+            if (t != MOTHVAL_SEXPR && t != MOTHVAL_QEXPR) { continue; }
+
+            if (n == mscan_cap) {
+                mscan_cap = mscan_cap ? mscan_cap * 2 : 64;
+                mscan_stack = realloc(mscan_stack, sizeof(mothval *) * mscan_cap);
+            }
+            mscan_stack[n++] = c;
+        }
+        if (n == 0) { return 0; }
+        v = mscan_stack[--n];
+    }
+}
+
+/* Make lambda 'f', created in call frame 'e', a closure over the
+   variables of the frame that its body uses, by copying their values
+   into its formals. Calling it then binds them in its own frame, as if
+   they were parameters */
+void mothval_capture(mothval *f, menv *e)
+{
+    char *used = calloc(e->count, 1);
+    int captured = 0;
+
+    for (int i = 0; i < e->count; i++) {
+        /* A parameter of the same name hides the variable */
+        int hidden = 0;
+        for (int j = 0; j < f->count; j++) {
+            if (f->formals->cell[j]->sym == e->syms[i]) { hidden = 1; }
+        }
+        if (!hidden && mothval_mentions(f->body, e->syms[i])) {
+            used[i] = 1;
+            captured++;
+        }
+    }
+
+    if (captured) {
+        mothval *formals = mothval_unshare(f->formals);
+        mothval_reserve(formals, formals->count + captured * 2);
+        for (int i = 0; i < e->count; i++) {
+            if (!used[i]) { continue; }
+            mothval *x = mothval_symbol(e->syms[i]);
+            mothval_append(formals, &x, 1);
+        }
+        for (int i = 0; i < e->count; i++) {
+            if (!used[i]) { continue; }
+            mothval *x = mothval_copy(e->vals[i]);
+            mothval_append(formals, &x, 1);
+        }
+        f->formals = formals;
+    }
+
+    free(used);
+}
+
+mothval *builtin_lambda(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 2, MERR_LAMBDA_ARGS);
+
+    LASSERT(a, mothval_type(a->cell[0]) == MOTHVAL_QEXPR
+               && mothval_type(a->cell[1]) == MOTHVAL_QEXPR,
+            MERR_LAMBDA_TYPE);
+
+    /* The formals must all be symbols */
+    for (int i = 0; i < a->cell[0]->count; i++) {
+        LASSERT(a, mothval_type(a->cell[0]->cell[i]) == MOTHVAL_SYM,
+                MERR_LAMBDA_FORMAL);
+    }
+
+    mothval *formals = mothval_pop(a, 0);
+    mothval *body = mothval_pop(a, 0);
+    mothval_del(a);
+
+    mothval *f = mothval_lambda(formals, body);
+    if (e->par) { mothval_capture(f, e); }
+    return f;
+}
+
+/* Whether 'x' and 'y' are equal, comparing lists element by element */
+int mothval_eq(mothval *x, mothval *y)
+{
+    if (mothval_type(x) != mothval_type(y)) { return 0; }
+
+    switch (mothval_type(x)) {
+    case MOTHVAL_NUM: return mothval_to_num(x) == mothval_to_num(y);
+    case MOTHVAL_ERR:
+        return strcmp(mothval_err_msg(x), mothval_err_msg(y)) == 0;
+    case MOTHVAL_SYM: return x->sym == y->sym;
+    case MOTHVAL_FUN: return x->fun == y->fun && x->native == y->native;
+    case MOTHVAL_LAMBDA:
+        return x->count == y->count && mothval_eq(x->formals, y->formals)
+            && mothval_eq(x->body, y->body);
+    case MOTHVAL_QEXPR:
+    case MOTHVAL_SEXPR:
+        if (x->count != y->count) { return 0; }
+        for (int i = 0; i < x->count; i++) {
+            if (!mothval_eq(x->cell[i], y->cell[i])) { return 0; }
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Orderings compared by builtin_ord */
+enum { MORD_GT, MORD_LT, MORD_GE, MORD_LE };
+
+mothval *builtin_ord(menv *e, mothval *a, int op)
+{
+    LASSERT(a, a->count == 2, MERR_CMP_ARGS);
+
+    LASSERT(a, mothval_type(a->cell[0]) == MOTHVAL_NUM
+               && mothval_type(a->cell[1]) == MOTHVAL_NUM,
+            MERR_CMP_TYPE);
+
+    long x = mothval_to_num(a->cell[0]);
+    long y = mothval_to_num(a->cell[1]);
+    int r = 0;
+    switch (op) {
+    case MORD_GT: r = x > y; break;
+    case MORD_LT: r = x < y; break;
+    case MORD_GE: r = x >= y; break;
+    case MORD_LE: r = x <= y; break;
+    }
+
+    mothval_del(a);
+    return mothval_num(r);
+}
+
+mothval *builtin_gt(menv *e, mothval *a) { return builtin_ord(e, a, MORD_GT); }
+mothval *builtin_lt(menv *e, mothval *a) { return builtin_ord(e, a, MORD_LT); }
+mothval *builtin_ge(menv *e, mothval *a) { return builtin_ord(e, a, MORD_GE); }
+mothval *builtin_le(menv *e, mothval *a) { return builtin_ord(e, a, MORD_LE); }
+
+/* Equality, or with 'negate' set, inequality */
+mothval *builtin_cmp(menv *e, mothval *a, int negate)
+{
+    LASSERT(a, a->count == 2, MERR_CMP_ARGS);
+
+    int r = mothval_eq(a->cell[0], a->cell[1]);
+    if (negate) { r = !r; }
+
+    mothval_del(a);
+    return mothval_num(r);
+}
+
+mothval *builtin_eq(menv *e, mothval *a) { return builtin_cmp(e, a, 0); }
+mothval *builtin_ne(menv *e, mothval *a) { return builtin_cmp(e, a, 1); }
+
+mothval *builtin_if(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 3, MERR_IF_ARGS);
+
+    LASSERT(a, mothval_type(a->cell[0]) == MOTHVAL_NUM, MERR_IF_COND);
+
+    LASSERT(a, mothval_type(a->cell[1]) == MOTHVAL_QEXPR
+               && mothval_type(a->cell[2]) == MOTHVAL_QEXPR,
+            MERR_IF_BRANCH);
+
+    /* The chosen branch is evaluated in place of the call */
+    mothval *x = mothval_take(a, mothval_to_num(a->cell[0]) ? 1 : 2);
+    x = mothval_unshare(x);
+    x->type = MOTHVAL_SEXPR;
+    return moth_tail(e, x, 0);
+}
+
+mothval *builtin_def(menv *e, mothval *a)
+{
+    LASSERT(a, mothval_type(a->cell[0]) == MOTHVAL_QEXPR, MERR_DEF_TYPE);
+
+    /* First argument is a list of symbols */
+    mothval *syms = a->cell[0];
+
+    for (int i = 0; i < syms->count; i++) {
+        LASSERT(a, mothval_type(syms->cell[i]) == MOTHVAL_SYM, MERR_DEF_SYM);
+    }
+
+    LASSERT(a, syms->count == a->count - 1, MERR_DEF_COUNT);
+
+    /* Bind a copy of each value to its symbol, globally even inside a
+       lambda */
+    menv *g = menv_root(e);
+    for (int i = 0; i < syms->count; i++) {
+        menv_put(g, syms->cell[i], a->cell[i + 1]);
+    }
+
+    mothval_del(a);
+    return mothval_sexpr();
+}
+
+/* Whether the section list given to 'stats' includes 'name' */
+int stats_wants(mothval *q, char *name)
+{
+    if (q->count == 0) { return 1; }
+
+    msym *s = msym_intern(name);
+    for (int i = 0; i < q->count; i++) {
+        if (q->cell[i]->sym == s) { return 1; }
+    }
+    return 0;
+}
+
+/* Print interpreter statistics for the sections named in the Q-Expression
+   argument, or for every section if it is empty */
+mothval *builtin_stats(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 1, MERR_STATS_ARGS);
+
+    LASSERT(a, mothval_type(a->cell[0]) == MOTHVAL_QEXPR, MERR_STATS_TYPE);
+
+    mothval *q = a->cell[0];
+    for (int i = 0; i < q->count; i++) {
+        LASSERT(a, mothval_type(q->cell[i]) == MOTHVAL_SYM, MERR_STATS_SECTION);
+    }
+
+    if (stats_wants(q, "mem")) {
+        mmem_print_stats();
+        if (moth_lazy_free) { mothval_lazy_print_stats(); }
+    }
+    if (stats_wants(q, "gc")) { mgc_print_stats(); }
+    if (stats_wants(q, "vm")) { mvm_print_stats(); }
+
+    mothval_del(a);
+    return mothval_sexpr();
+}
+
+void menv_add_builtin(menv *e, char *name, mbuiltin func)
+{
+    mothval *k = mothval_sym(name);
+    mothval *v = mothval_fun(func);
+    menv_put(e, k, v);
+    mothval_del(k); mothval_del(v);
+}
+
+/* Forward declare */
+mothval *builtin_map(menv *e, mothval *a);
+mothval *builtin_filter(menv *e, mothval *a);
+mothval *builtin_fold(menv *e, mothval *a);
+mothval *builtin_pmap(menv *e, mothval *a);
+mothval *builtin_preduce(menv *e, mothval *a);
+
+/* Builtins bound into every new environment. The core set is fixed;
+   native code adds its own with moth_register_builtin, before making
+   contexts on other threads */
+typedef struct {
+    char *name;
+    mbuiltin fun;
+    moth_builtin native;
+} mbuiltin_entry;
+
+static const mbuiltin_entry mbuiltins_core[] = {
+    /* List functions */
+    { "list", builtin_list },
+    { "head", builtin_head },
+    { "tail", builtin_tail },
+    { "eval", builtin_eval },
+    { "join", builtin_join },
+    { "map", builtin_map },
+    { "filter", builtin_filter },
+    { "fold", builtin_fold },
+    { "pmap", builtin_pmap },
+    { "preduce", builtin_preduce },
+
+    /* Mathematical functions */
+    { "+", builtin_add },
+    { "-", builtin_sub },
+    { "*", builtin_mul },
+    { "/", builtin_div },
+
+    /* Variable functions */
+    { "def", builtin_def },
+    { "\\", builtin_lambda },
+
+    /* Comparison functions */
+    { "if", builtin_if },
+    { "==", builtin_eq },
+    { "!=", builtin_ne },
+    { ">", builtin_gt },
+    { "<", builtin_lt },
+    { ">=", builtin_ge },
+    { "<=", builtin_le },
+
+    /* Interpreter functions */
+    { "stats", builtin_stats },
+};
+
+static mbuiltin_entry *mbuiltins = NULL;
+static int mbuiltins_count = 0;
+
+/* Register a native builtin under 'name'. Environments created after
+   this get it bound; a later registration of the same name wins */
+void moth_register_builtin(const char *name, moth_builtin func)
+{
+    char *copy = malloc(strlen(name) + 1);
+    strcpy(copy, name);
+
+    mbuiltins_count++;
+    mbuiltins = realloc(mbuiltins, sizeof(mbuiltin_entry) * mbuiltins_count);
+    mbuiltins[mbuiltins_count - 1] = (mbuiltin_entry){ copy, NULL, func };
+}
+
+void menv_add_builtins(menv *e)
+{
+    int ncore = sizeof(mbuiltins_core) / sizeof(mbuiltins_core[0]);
+    for (int i = 0; i < ncore; i++) {
+        menv_add_builtin(e, mbuiltins_core[i].name, mbuiltins_core[i].fun);
+    }
+    for (int i = 0; i < mbuiltins_count; i++) {
+        mothval *k = mothval_sym(mbuiltins[i].name);
+        mothval *v = mothval_native(mbuiltins[i].native);
+        menv_put(e, k, v);
+        mothval_del(k); mothval_del(v);
+    }
+}
+
+/* Tree-walking evaluator, kept behind -t for comparison with the VM */
+
+mothval *mothval_eval_sexpr(menv *e, mothval *v);
+
+mothval *mothval_eval(menv *e, mothval *v)
+{
+    if (mothval_type(v) == MOTHVAL_SYM) {
+        mothval *x = menv_get(e, v);
+        mothval_del(v);
+        return x;
+    }
+
+    if (mothval_type(v) == MOTHVAL_SEXPR) { return mothval_eval_sexpr(e, v); }
+    return v;
+}
+
+/* An S-Expression part way through being evaluated. Cells before 'i'
+   have been evaluated in place, and 'frame' is the call frame of a
+   lambda running in place of the expression, freed along with it */
+typedef struct {
+    mothval *v;
+    int i;
+    menv *e;
+    menv *frame;
+} mwalk_frame;
+
+/* Expressions being evaluated, innermost last, shared by nested runs */
+static _Thread_local mwalk_frame *mwalk_stack = NULL;
+static _Thread_local int mwalk_count = 0;
+static _Thread_local int mwalk_cap = 0;
+
+/* Get S-Expression 'v' ready to have its cells evaluated in place */
+static mothval *mothval_eval_prepare(mothval *v)
+{
+    v = mothval_unshare(v);
+
+    /* A lone S-Expression is evaluated in place of this one */
+    while (v->count == 1 && mothval_type(v->cell[0]) == MOTHVAL_SEXPR) {
+        v = mothval_unshare(mothval_take(v, 0));
+    }
+
+    mothval_own(v);
+    return v;
+}
+
+static void mwalk_push(menv *e, mothval *v)
+{
+    if (mwalk_count == mwalk_cap) {
+        mwalk_cap = mwalk_cap ? mwalk_cap * 2 : 64;
+        mwalk_stack = realloc(mwalk_stack, sizeof(mwalk_frame) * mwalk_cap);
+    }
+    mwalk_frame *f = &mwalk_stack[mwalk_count++];
+    f->v = mothval_eval_prepare(v);
+    f->i = 0;
+    f->e = e;
+    f->frame = NULL;
+}
+
+/* Apply the evaluated cells of 'v' in 'e'. The result may be
+   MOTHVAL_TAIL */
+static mothval *mwalk_apply(menv *e, mothval *v)
+{
+    if (v->count == 0) { return v; }
+    if (v->count == 1) { return mothval_take(v, 0); }
+
+    /* Ensure that the first element is a function, after eval */
+    mothval *fn = mothval_pop(v, 0);
+    if (mothval_type(fn) != MOTHVAL_FUN && mothval_type(fn) != MOTHVAL_LAMBDA) {
+        mothval_del(v);
+        mothval_del(fn);
+        return mothval_error(MERR_NOT_FUNCTION);
+    }
+
+    /* Call function to get result */
+    mothval *x = mothval_call(e, fn, v);
+    mothval_del(fn);
+    return x;
+}
+
+/* Evaluate S-Expression 'v'. Nested S-Expressions are pushed onto the
+   stack of expressions instead of recursing, so nesting of any depth
+   can be evaluated, and a call in tail position replaces the
+   expression that made it */
+mothval *mothval_eval_sexpr(menv *e, mothval *v)
+{
+    /* A builtin can run the evaluator again from in here, so this run
+       only uses the frames above where it started */
+    int base = mwalk_count;
+    mwalk_push(e, v);
+
+    for (;;) {
+        mwalk_frame *f = &mwalk_stack[mwalk_count - 1];
+        v = f->v;
+
+        mothval *result;
+
+        /* Children are evaluated in place, nested expressions on top of
+           this one. The first error is the value of the expression, and
+           the cells after it are not evaluated */
+        if (f->i < v->count) {
+            mothval *c = v->cell[f->i];
+            if (mothval_type(c) == MOTHVAL_SEXPR) {
+                v->cell[f->i] = NULL;
+                mwalk_push(f->e, c);
+                continue;
+            }
+            if (mothval_type(c) == MOTHVAL_SYM) {
+                v->cell[f->i] = menv_get(f->e, c);
+                mothval_del(c);
+            }
+            if (mothval_type(v->cell[f->i]) != MOTHVAL_ERR) {
+                f->i++;
+                continue;
+            }
+            result = mothval_take(v, f->i);
+        } else {
+            mgc_barrier(v);
+            result = mwalk_apply(f->e, v);
+
+            /* Evaluate the tail expression in place of this one */
+            if (result == MOTHVAL_TAIL) {
+                f = &mwalk_stack[mwalk_count - 1];
+                mothval *x = mothval_unshare(mtail_expr);
+                x->type = MOTHVAL_SEXPR;
+                f->v = mothval_eval_prepare(x);
+                f->i = 0;
+                if (mtail_frame) {
+                    if (f->frame) { menv_del(f->frame); }
+                    f->frame = mtail_env;
+                }
+                f->e = mtail_env;
+                continue;
+            }
+        }
+
+        /* This expression is done */
+        f = &mwalk_stack[--mwalk_count];
+        if (f->frame) { menv_del(f->frame); }
+
+        /* An error is the value of every expression it is nested in, so
+           they are dropped without evaluating the rest of their cells */
+        if (mothval_type(result) == MOTHVAL_ERR) {
+            while (mwalk_count > base) {
+                f = &mwalk_stack[--mwalk_count];
+                f->v->cell[f->i] = mothval_num(0);
+                mothval_del(f->v);
+                if (f->frame) { menv_del(f->frame); }
+            }
+        }
+
+        /* The value goes into the cell it came from */
+        if (mwalk_count == base) { return result; }
+        f = &mwalk_stack[mwalk_count - 1];
+        f->v->cell[f->i++] = result;
+    }
+}
+
+/*
+ * Bytecode VM
+ *
+ * An S-Expression is compiled once into a chunk: a flat instruction
+ * stream plus a table of constants. Every instruction is one opcode
+ * byte followed by a 32-bit operand. The chunk is cached on the list
+ * it was compiled from and shared by its copies, so evaluating a bound
+ * Q-Expression again only runs the dispatch loop.
+ *
+ * Names are resolved while compiling, for the environment the chunk is
+ * compiled for. A parameter of its call frame is read from the frame's
+ * slot for it, and any other name from its binding in the global
+ * environment, which 'def' updates in place. A chunk that is later run
+ * in an environment of another shape, as 'eval' can do, looks its names
+ * up by symbol instead. Each global name it reads then caches the
+ * binding it finds, for the global environment it found it in.
+ *
+ * In a Q-Expression, a call of a pure builtin whose arguments are all
+ * literals, or such calls themselves, is evaluated while compiling.
+ * Its value is pushed in place of running the call for as long as no
+ * global bound to a builtin is redefined, and the call is compiled as
+ * usual after it for when one is. A call that fails, as one that
+ * overflows does, is left to fail when it runs.
+ *
+ * With more than one thread, a call with at least two other calls among
+ * its cells starts with an OP_PAR, which can evaluate the cells on the
+ * worker threads instead of running the code for them that follows.
+ */
+
+enum {
+    OP_CONST,   /* push a copy of consts[operand] */
+    OP_LOCAL,   /* push the value in slot operand of the call frame */
+    OP_GLOBAL,  /* push the value of the global read at globals[operand] */
+    OP_CALL,    /* apply the top operand values, function first */
+    OP_RETURN,
+    OP_FAIL,    /* fail with the error consts[operand] */
+    OP_FOLD,    /* push consts[operand] and run the OP_SKIP after it if
+                   nothing it was folded from has been redefined, and
+                   otherwise run the code after that */
+    OP_SKIP,    /* jump operand bytes forward */
+    OP_PAR      /* push the cells of the call at pars[operand] evaluated
+                   in parallel and run the OP_SKIP after it, or run the
+                   code after that if they are not worth it */
+};
+
+/* A read of a global name. 'bind' is its binding in the global
+   environment the chunk was compiled for, and 'cached' the one last
+   found in global environment 'root' when running somewhere else.
+   Bindings are never removed and 'def' updates them in place, so
+   neither goes stale */
+typedef struct {
+    mbind *bind;
+    unsigned long root;
+    mbind *cached;
+} mvm_global;
+
+/* A call whose cells may be evaluated in parallel, which is consts[k].
+   Whether they only compute values and whether one of them that is a
+   call reaches a lambda, as far as globals and the values of their own
+   closures tell, were last found out in global environment 'root' after
+   'defs' definitions. 'slots' are the frame slots the cells read, and
+   'call_slots' those read by cells that are calls. The decision is read
+   without a lock, and 'seq' is odd while a new one is being written */
+typedef struct {
+    int k;
+    unsigned seq;
+    int pure;
+    int heavy;
+    uint64_t slots;
+    uint64_t call_slots;
+    unsigned long root;
+    unsigned long defs;
+} mvm_par;
+
+typedef struct {
+    long global_reads;  /* globals read from the binding compiled in */
+    long cache_hits;    /* globals read from a cached binding */
+    long cache_misses;  /* globals looked up and cached */
+} mvm_counters;
+
+static _Thread_local mvm_counters mvm_stats;
+
+struct mchunk {
+    int refs;
+    int count;
+    int cap;
+    unsigned char *code;
+
+    int nconsts;
+    int consts_cap;
+    mothval **consts;
+
+    /* Deepest the value stack gets while running this chunk */
+    int depth;
+
+    /* The environment it was compiled for: the id of the global one and
+       the parameters of the call frame, if any */
+    unsigned long root;
+    int nscope;
+    msym **scope;
+
+    int nglobals;
+    int globals_cap;
+    mvm_global *globals;
+
+    int npars;
+    int pars_cap;
+    mvm_par *pars;
+
+    /* Whether it has been run, after which it is never recompiled */
+    int ran;
+
+    /* Redefinitions of builtins in the global environment when it was
+       compiled, which its folded calls assume are all there are */
+    unsigned long redefs;
+};
+
+mchunk *mchunk_retain(mchunk *c)
+{
+    if (c) { mref_inc(c->refs); }
+    return c;
+}
+
+void mchunk_release(mchunk *c)
+{
+    if (!c || mref_dec(c->refs) > 0) { return; }
+    for (int i = 0; i < c->nconsts; i++) {
+        mothval_del(c->consts[i]);
+    }
+    free(c->consts);
+    free(c->code);
+    free(c->scope);
+    free(c->globals);
+    free(c->pars);
+    free(c);
+}
+
+void mchunk_emit(mchunk *c, int op, int arg)
+{
+    if (c->count + 5 > c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->code = realloc(c->code, c->cap);
+    }
+    c->code[c->count++] = op;
+    memcpy(&c->code[c->count], &arg, sizeof(int));
+    c->count += sizeof(int);
+}
+
+int mchunk_const(mchunk *c, mothval *v)
+{
+    if (c->nconsts == c->consts_cap) {
+        c->consts_cap = c->consts_cap ? c->consts_cap * 2 : 8;
+        c->consts = realloc(c->consts, sizeof(mothval *) * c->consts_cap);
+    }
+    c->consts[c->nconsts] = v;
+    return c->nconsts++;
+}
+
+int mchunk_global(mchunk *c, mbind *b)
+{
+    if (c->nglobals == c->globals_cap) {
+        c->globals_cap = c->globals_cap ? c->globals_cap * 2 : 8;
+        c->globals = realloc(c->globals, sizeof(mvm_global) * c->globals_cap);
+    }
+    c->globals[c->nglobals].bind = b;
+    c->globals[c->nglobals].root = c->root;
+    c->globals[c->nglobals].cached = b;
+    return c->nglobals++;
+}
+
+int mchunk_par(mchunk *c, int k)
+{
+    if (c->npars == c->pars_cap) {
+        c->pars_cap = c->pars_cap ? c->pars_cap * 2 : 4;
+        c->pars = realloc(c->pars, sizeof(mvm_par) * c->pars_cap);
+    }
+    c->pars[c->npars] = (mvm_par){ .k = k };
+    return c->npars++;
+}
+
+/* An S-Expression part way through being compiled. Code for the cells
+   before 'i' has been emitted, and 'sp' is the stack height before the
+   first of them. If it was folded, 'skip' is where the OP_SKIP over its
+   code is, and if its cells can be evaluated in parallel, 'par' is where
+   the one over the code for them is. Either is -1 otherwise */
+typedef struct {
+    mothval *v;
+    int i;
+    int sp;
+    int skip;
+    int par;
+} mvm_task;
+
+/* A Q-Expression constant waiting for its own chunk, which goes into
+   slot 'k' of chunk 'c' once it has one */
+typedef struct {
+    mothval *v;
+    mchunk *c;
+    int k;
+} mvm_quote;
+
+static _Thread_local mvm_task *mvm_tasks = NULL;
+static _Thread_local int mvm_ntasks = 0;
+static _Thread_local int mvm_tasks_cap = 0;
+
+static _Thread_local mvm_quote *mvm_quotes = NULL;
+static _Thread_local int mvm_nquotes = 0;
+static _Thread_local int mvm_quotes_cap = 0;
+
+/* The environment being compiled for */
+static _Thread_local menv *mvm_env;
+
+/* Whether calls are folded in the chunk being compiled. Only those of
+   Q-Expressions are, as the line typed in runs once */
+static _Thread_local int mvm_folding = 0;
+
+/* Folded calls among the tasks, inside which nothing is folded again */
+static _Thread_local int mvm_nfolded = 0;
+
+/* How deeply nested calls are folded, which bounds the recursion */
+#define MVM_FOLD_DEPTH 16
+
+/* Whether 'f' always returns the same value for the same arguments and
+   does nothing else */
+static int mvm_pure(mbuiltin f)
+{
+    return f == builtin_add || f == builtin_sub || f == builtin_mul
+        || f == builtin_div || f == builtin_list || f == builtin_head
+        || f == builtin_tail || f == builtin_join || f == builtin_eq
+        || f == builtin_ne || f == builtin_gt || f == builtin_lt
+        || f == builtin_ge || f == builtin_le;
+}
+
+static mothval *mvm_fold_call(mchunk *c, mothval *v, int depth);
+
+/* The value of literal 'v' as an argument, or NULL if it is not one */
+static mothval *mvm_fold(mchunk *c, mothval *v, int depth)
+{
+    while (mothval_type(v) == MOTHVAL_SEXPR && v->count == 1) {
+        v = v->cell[0];
+    }
+
+    switch (mothval_type(v)) {
+    case MOTHVAL_NUM:
+    case MOTHVAL_QEXPR:
+        return mothval_copy(v);
+    case MOTHVAL_SEXPR:
+        if (v->count == 0) { return mothval_sexpr(); }
+        return mvm_fold_call(c, v, depth);
+    }
+    return NULL;
+}
+
+/* The value of the cells of 'v' as a call of a pure builtin on
+   literals, or NULL if they are not one or the call fails */
+static mothval *mvm_fold_call(mchunk *c, mothval *v, int depth)
+{
+    if (depth == MVM_FOLD_DEPTH || mothval_type(v->cell[0]) != MOTHVAL_SYM) {
+        return NULL;
+    }
+
+    /* The name must be a global, bound to a pure builtin right now */
+    msym *s = v->cell[0]->sym;
+    for (int k = 0; k < c->nscope; k++) {
+        if (c->scope[k] == s) { return NULL; }
+    }
+    menv *root = menv_root(mvm_env);
+    if (root->count == 0) { return NULL; }
+    int i = menv_slot(root, s);
+    if (!root->syms[i]) { return NULL; }
+    mothval *f = root->binds[i]->val;
+    if (!f || mothval_type(f) != MOTHVAL_FUN || !mvm_pure(f->fun)) {
+        return NULL;
+    }
+
+    mothval *a = mothval_sexpr();
+    for (int j = 1; j < v->count; j++) {
+        mothval *x = mvm_fold(c, v->cell[j], depth + 1);
+        if (!x) { mothval_del(a); return NULL; }
+        mothval_append(a, &x, 1);
+    }
+
+    mothval *x = f->fun(mvm_env, a);
+    if (mothval_type(x) == MOTHVAL_ERR) { mothval_del(x); return NULL; }
+    return x;
+}
+
+/* Cell 'v' of a call, as the expression it evaluates */
+static mothval *mvm_expr(mothval *v)
+{
+    while (mothval_type(v) == MOTHVAL_SEXPR && v->count == 1) {
+        v = v->cell[0];
+    }
+    return v;
+}
+
+/* Whether cell 'v' of a call is a call itself */
+static int mvm_is_call(mothval *v)
+{
+    v = mvm_expr(v);
+    return mothval_type(v) == MOTHVAL_SEXPR && v->count > 0;
+}
+
+/* Whether the cells of call 'v' may be worth evaluating in parallel,
+   which takes at least two calls among them */
+static int mvm_parallel(mothval *v)
+{
+    if (moth_threads < 2) { return 0; }
+    int calls = 0;
+    for (int i = 0; i < v->count; i++) { calls += mvm_is_call(v->cell[i]); }
+    return calls >= 2;
+}
+
+/* Leave a call to be compiled cell by cell from the task stack, after
+   its folded value if it has one */
+static void mvm_compile_call(mchunk *c, mothval *v, int sp)
+{
+    int skip = -1;
+    mothval *x = NULL;
+    if (mvm_folding && !mvm_nfolded) { x = mvm_fold_call(c, v, 0); }
+    if (x) {
+        mchunk_emit(c, OP_FOLD, mchunk_const(c, x));
+        skip = c->count;
+        mchunk_emit(c, OP_SKIP, 0);
+        mvm_nfolded++;
+    }
+
+    /* The chunk keeps its own node for the call, as one that is 'v'
+       itself would keep the list that owns the chunk alive */
+    int par = -1;
+    if (mvm_parallel(v)) {
+        mchunk_emit(c, OP_PAR, mchunk_par(c, mchunk_const(c, mothval_dup(v))));
+        par = c->count;
+        mchunk_emit(c, OP_SKIP, 0);
+    }
+
+    if (mvm_ntasks == mvm_tasks_cap) {
+        mvm_tasks_cap = mvm_tasks_cap ? mvm_tasks_cap * 2 : 64;
+        mvm_tasks = realloc(mvm_tasks, sizeof(mvm_task) * mvm_tasks_cap);
+    }
+    mvm_tasks[mvm_ntasks].v = v;
+    mvm_tasks[mvm_ntasks].i = 0;
+    mvm_tasks[mvm_ntasks].sp = sp;
+    mvm_tasks[mvm_ntasks].skip = skip;
+    mvm_tasks[mvm_ntasks].par = par;
+    mvm_ntasks++;
+}
+
+/* Start compiling code that leaves the value of 'v' on the stack. 'sp'
+   is the stack height before it runs */
+static void mvm_compile_expr(mchunk *c, mothval *v, int sp)
+{
+    if (sp + 1 > c->depth) { c->depth = sp + 1; }
+
+    /* A single expression evaluates to its only element */
+    v = mvm_expr(v);
+
+    switch (mothval_type(v)) {
+    case MOTHVAL_SYM:
+        for (int k = 0; k < c->nscope; k++) {
+            if (c->scope[k] == v->sym) {
+                mchunk_emit(c, OP_LOCAL, k);
+                return;
+            }
+        }
+        mchunk_emit(c, OP_GLOBAL,
+                    mchunk_global(c, menv_bind(menv_root(mvm_env), v->sym)));
+        return;
+
+    case MOTHVAL_QEXPR: {
+        /* Quoted lists are usually code waiting for 'eval', so compile
+           them up front and let every copy pushed at runtime share it.
+           That happens once this chunk is done, since they can be nested
+           as deeply as anything else */
+        if (v->code) { break; }
+        if (mvm_nquotes == mvm_quotes_cap) {
+            mvm_quotes_cap = mvm_quotes_cap ? mvm_quotes_cap * 2 : 64;
+            mvm_quotes = realloc(mvm_quotes, sizeof(mvm_quote) * mvm_quotes_cap);
+        }
+        mvm_quote *q = &mvm_quotes[mvm_nquotes++];
+        q->v = v;
+        q->c = c;
+        q->k = mchunk_const(c, NULL);
+        mchunk_emit(c, OP_CONST, q->k);
+        return;
+    }
+
+    case MOTHVAL_ERR:
+        mchunk_emit(c, OP_FAIL, mchunk_const(c, mothval_copy(v)));
+        return;
+
+    case MOTHVAL_SEXPR:
+        /* An empty expression evaluates to itself */
+        if (v->count == 0) {
+            mchunk_emit(c, OP_CONST, mchunk_const(c, mothval_sexpr()));
+            return;
+        }
+
+        mvm_compile_call(c, v, sp);
+        return;
+    }
+
+    mchunk_emit(c, OP_CONST, mchunk_const(c, mothval_copy(v)));
+}
+
+/* Compile the evaluation of the cells of list 'v' as an S-Expression,
+   without recursing into the lists in it */
+static mchunk *mvm_compile_cells(mothval *v)
+{
+    mchunk *c = calloc(1, sizeof(mchunk));
+    c->refs = 1;
+    c->root = menv_root(mvm_env)->id;
+    c->redefs = menv_root(mvm_env)->redefs;
+    mvm_folding = mothval_type(v) == MOTHVAL_QEXPR;
+    if (mvm_env->par) {
+        c->nscope = mvm_env->count;
+        c->scope = malloc(sizeof(msym *) * c->nscope);
+        memcpy(c->scope, mvm_env->syms, sizeof(msym *) * c->nscope);
+    }
+
+    /* The cells are compiled as an S-Expression whatever 'v' is */
+    if (v->count == 0) {
+        c->depth = 1;
+        mchunk_emit(c, OP_CONST, mchunk_const(c, mothval_sexpr()));
+    } else if (v->count == 1) {
+        mvm_compile_expr(c, v->cell[0], 0);
+    } else {
+        mvm_compile_call(c, v, 0);
+    }
+
+    while (mvm_ntasks > 0) {
+        mvm_task *t = &mvm_tasks[mvm_ntasks - 1];
+        if (t->i < t->v->count) {
+            int i = t->i++;
+            mvm_compile_expr(c, t->v->cell[i], t->sp + i);
+            continue;
+        }
+        if (t->par >= 0) {
+            int n = c->count - (t->par + 1 + sizeof(int));
+            memcpy(&c->code[t->par + 1], &n, sizeof(int));
+        }
+        mchunk_emit(c, OP_CALL, t->v->count);
+        if (t->skip >= 0) {
+            int n = c->count - (t->skip + 1 + sizeof(int));
+            memcpy(&c->code[t->skip + 1], &n, sizeof(int));
+            mvm_nfolded--;
+        }
+        mvm_ntasks--;
+    }
+
+    mchunk_emit(c, OP_RETURN, 0);
+    return c;
+}
+
+/* Compile the evaluation of list 'v' as an S-Expression in 'e' */
+mchunk *mvm_compile(mothval *v, menv *e)
+{
+    /* Chunks are cached on values that may be bound, so their constants
+       must outlive the current line */
+    mmem_persist_begin();
+    mvm_env = e;
+
+    mchunk *c = mvm_compile_cells(v);
+
+    /* Compile the quoted lists met on the way, and any quoted in them.
+       It is the constant that is compiled, so that a copy made of a
+       value in the line arena shares its cells with the constants of
+       its own chunk rather than copying them again. A list quoted in
+       a constant is already part of a copy of its own, so it is shared
+       even with -d, which would otherwise copy each level once more */
+    while (mvm_nquotes > 0) {
+        mvm_quote q = mvm_quotes[--mvm_nquotes];
+        mothval *x = q.c->consts[q.k]
+                   = q.c == c ? mothval_copy(q.v) : mothval_share(q.v);
+        if (!x->code) { x->code = mvm_compile_cells(x); mgc_barrier(x); }
+    }
+
+    mmem_persist_end();
+    return c;
+}
+
+/* Value stack shared by nested runs of the VM on this thread */
+static _Thread_local mothval **mvm_stack = NULL;
+static _Thread_local int mvm_cap = 0;
+static _Thread_local int mvm_sp = 0;
+
+/* The chunk and environment of each chunk being run, innermost last.
+   A chunk that is waiting for the one above it to return resumes at
+   'ip', and 'frame' is the call frame of a lambda it owns, if any. The
+   chunk's values start at 'sp' on the value stack, and 'dyn' is set if
+   it looks names up by symbol */
+typedef struct {
+    mchunk *c;
+    menv *e;
+    unsigned char *ip;
+    menv *frame;
+    int sp;
+    int dyn;
+} mvm_frame;
+
+static _Thread_local mvm_frame *mvm_frames = NULL;
+static _Thread_local int mvm_nframes = 0;
+static _Thread_local int mvm_frames_cap = 0;
+
+/*
+ * Tracing collector
+ *
+ * With -g values are not reference counted. Copies are the value itself,
+ * mothval_del does nothing, and anything about to change a value works
+ * on a copy of it. Memory is reclaimed by a generational collector whose
+ * roots are the environment, the VM stack and the expressions being
+ * evaluated.
+ *
+ * New nodes, and cell blocks up to MGC_YOUNG_MAX bytes, are bumped out
+ * of the nursery. A minor collection copies whatever is still reachable
+ * from the roots, or from old values that were given pointers into the
+ * nursery, into the old space, leaving a forwarding pointer behind, and
+ * then starts the nursery over. Changing an old list records it with
+ * mgc_barrier so the next minor collection visits it. The old space is
+ * allocated from the slabs and reclaimed by a mark-sweep of everything
+ * once it has doubled.
+ *
+ * Collections only run at a safe point, where nothing live is held in a
+ * C local: between REPL lines, and in the VM before a call, while the
+ * arguments are still on the stack. The refs field of a node, and the
+ * flags of a block, hold the collector's state instead.
+ *
+ * Each thread has a heap of its own, which holds the values of the
+ * contexts it runs.
+ */
+
+/* Size of the nursery, which is collected once it fills up */
+#ifndef MGC_NURSERY
+#define MGC_NURSERY (1 << 20)
+#endif
+
+/* Bytes allocated in the old space before the first major collection,
+   and the least it may grow by between major collections */
+#ifndef MGC_MIN_HEAP
+#define MGC_MIN_HEAP (4 << 20)
+#endif
+
+/* Bigger cell blocks are allocated in the old space directly */
+#define MGC_YOUNG_MAX 1024
+
+/* Number of recent major cycles kept for 'stats' */
+#define MGC_HISTORY 8
+
+/* Minor pauses are counted in power of two buckets of microseconds */
+#define MGC_BUCKETS 24
+
+enum {
+    MGC_MARK = 1,           /* reached by the major mark */
+    MGC_OLD = 2,            /* lives in the old space */
+    MGC_REMEMBERED = 4,     /* old, and may point into the nursery */
+    MGC_FORWARD = 8,        /* moved to the old space */
+    MGC_CODE = 16           /* young, and holds a reference to a chunk */
+};
+
+typedef struct {
+    void **items;
+    size_t count;
+    size_t cap;
+} mgc_vec;
+
+typedef struct {
+    long cycle;
+    double pause;       /* milliseconds */
+    size_t reclaimed;   /* bytes */
+    size_t live;        /* bytes */
+} mgc_cycle;
+
+static _Thread_local mgc_vec mgc_vals;        /* every old node */
+static _Thread_local mgc_vec mgc_cells;       /* every old cell block */
+static _Thread_local mgc_vec mgc_gray;        /* nodes whose children are not done */
+static _Thread_local mgc_vec mgc_remembered;  /* old nodes changed since the last minor */
+static _Thread_local mgc_vec mgc_young_code;  /* young nodes holding a chunk */
+static _Thread_local mgc_vec mgc_new_chunks;  /* chunks given new constants in place */
+
+/* The nursery is one block, with more chained on if a single step of
+   evaluation allocates more than it holds */
+static _Thread_local mmem_block *mgc_nursery = NULL;
+static _Thread_local size_t mgc_nursery_used = 0;
+
+static _Thread_local size_t mgc_allocated = 0;
+static _Thread_local size_t mgc_threshold = MGC_MIN_HEAP;
+
+static _Thread_local long mgc_minors = 0;
+static _Thread_local double mgc_minor_total = 0;
+static _Thread_local size_t mgc_promoted = 0;
+static _Thread_local long mgc_minor_pauses[MGC_BUCKETS];
+
+static _Thread_local long mgc_cycles = 0;
+static _Thread_local double mgc_pause_total = 0;
+static _Thread_local double mgc_pause_max = 0;
+static _Thread_local size_t mgc_reclaimed = 0;
+static _Thread_local mgc_cycle mgc_history[MGC_HISTORY];
+
+static void mgc_push(mgc_vec *s, void *p)
+{
+    if (s->count == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->items = realloc(s->items, sizeof(void *) * s->cap);
+    }
+    s->items[s->count++] = p;
+}
+
+/* Bump 'n' bytes out of the nursery, or return NULL if they would not
+   fit in an empty one */
+static void *mgc_bump(size_t n)
+{
+    n = (n + 7) & ~(size_t)7;
+    if (n > MGC_NURSERY) { return NULL; }
+
+    if (!mgc_nursery || mgc_nursery->used + n > mgc_nursery->size) {
+        mmem_block *b = malloc(sizeof(mmem_block) + MGC_NURSERY);
+        b->next = mgc_nursery;
+        b->used = 0;
+        b->size = MGC_NURSERY;
+        mgc_nursery = b;
+    }
+
+    void *p = mgc_nursery->data + mgc_nursery->used;
+    mgc_nursery->used += n;
+    mgc_nursery_used += n;
+    return p;
+}
+
+static mothval *mgc_alloc_old(size_t size)
+{
+    mothval *v = mmem_alloc(size);
+    v->refs = MGC_OLD;
+    mgc_push(&mgc_vals, v);
+    mgc_allocated += size;
+    return v;
+}
+
+static mcells *mgc_alloc_old_cells(int cap)
+{
+    mcells *b = mmem_alloc(MCELLS_SIZE(cap));
+    b->flags = MGC_OLD;
+    mgc_push(&mgc_cells, b);
+    mgc_allocated += MCELLS_SIZE(cap);
+    return b;
+}
+
+mothval *mgc_alloc(size_t size)
+{
+    mothval *v = mgc_bump(size);
+    if (!v) { return mgc_alloc_old(size); }
+    v->refs = 0;
+    return v;
+}
+
+mcells *mgc_alloc_cells(int cap)
+{
+    if (MCELLS_SIZE(cap) > MGC_YOUNG_MAX) { return mgc_alloc_old_cells(cap); }
+    mcells *b = mgc_bump(MCELLS_SIZE(cap));
+    b->flags = 0;
+    return b;
+}
+
+/* Record a change to list 'v'. An old list may now point into the
+   nursery, and a young one may have been given a chunk, which has to be
+   released if it dies there */
+void mgc_remember(mothval *v)
+{
+    if (v->refs & MGC_OLD) {
+        if (v->refs & MGC_REMEMBERED) { return; }
+        v->refs |= MGC_REMEMBERED;
+        mgc_push(&mgc_remembered, v);
+        return;
+    }
+
+    if (v->code && !(v->refs & MGC_CODE)) {
+        v->refs |= MGC_CODE;
+        mgc_push(&mgc_young_code, v);
+    }
+}
+
+/* Record that chunk 'c' was given new constants, which may be in the
+   nursery. The values sharing it may be old and not remembered, so the
+   next minor collection visits its constants from here */
+void mgc_remember_chunk(mchunk *c)
+{
+    if (!moth_gc) { return; }
+    mgc_push(&mgc_new_chunks, mchunk_retain(c));
+}
+
+/* Pass every root slot to 'visit': the values bound in 'e' and every
+   environment it is a frame of, the VM stack, and the constants and
+   environments of the runs of the VM in progress. Each environment is
+   visited once, as frames all share the global one */
+static void mgc_visit_env(menv *e, void (*visit)(mothval **))
+{
+    if (e->par) {
+        for (int i = 0; i < e->count; i++) { visit(&e->vals[i]); }
+    }
+    for (int i = 0; i < e->cap; i++) {
+        if (e->syms[i] && e->binds[i]->val) { visit(&e->binds[i]->val); }
+    }
+}
+
+static void mgc_visit_roots(menv *e, void (*visit)(mothval **))
+{
+    if (e) {
+        for (menv *f = e; f; f = f->par) { mgc_visit_env(f, visit); }
+    }
+
+    for (int i = 0; i < mvm_sp; i++) { visit(&mvm_stack[i]); }
+
+    for (int i = 0; i < mvm_nframes; i++) {
+        mvm_frame *f = &mvm_frames[i];
+        if (f->e != e && f->e->par) { mgc_visit_env(f->e, visit); }
+        for (int j = 0; j < f->c->nconsts; j++) { visit(&f->c->consts[j]); }
+    }
+}
+
+/* Minor collection */
+
+/* Return where nursery value 'v' lives in the old space, moving it there
+   first if this is the first time it has been reached */
+static mothval *mgc_evacuate(mothval *v)
+{
+    if (mothval_is_imm(v) || (v->refs & MGC_OLD)) { return v; }
+    if (v->refs & MGC_FORWARD) { return v->forward; }
+
+    size_t size = mothval_size(v);
+    mothval *x = mgc_alloc_old(size);
+    memcpy(x, v, size);
+    x->refs = MGC_OLD;
+    mgc_promoted += size;
+
+    if (v->type == MOTHVAL_SEXPR || v->type == MOTHVAL_QEXPR) {
+        if (mothval_is_inline(v)) { x->cell = mothval_inline(x); }
+        mgc_push(&mgc_gray, x);
+    }
+    if (v->type == MOTHVAL_LAMBDA) { mgc_push(&mgc_gray, x); }
+
+    v->refs = MGC_FORWARD;
+    v->forward = x;
+    return x;
+}
+
+static void mgc_evacuate_root(mothval **slot) { *slot = mgc_evacuate(*slot); }
+
+static mcells *mgc_evacuate_cells(mcells *b)
+{
+    if (b->flags & MGC_OLD) { return b; }
+    if (b->flags & MGC_FORWARD) { return (mcells *)b->items[0]; }
+
+    mcells *x = mgc_alloc_old_cells(b->cap);
+    memcpy(x, b, MCELLS_SIZE(b->cap));
+    x->flags = MGC_OLD;
+    mgc_promoted += MCELLS_SIZE(b->cap);
+
+    b->flags = MGC_FORWARD;
+    b->items[0] = (mothval *)x;
+    return x;
+}
+
+/* Move everything old list or lambda 'v' holds out of the nursery */
+static void mgc_scan(mothval *v)
+{
+    if (v->type == MOTHVAL_LAMBDA) {
+        v->formals = mgc_evacuate(v->formals);
+        v->body = mgc_evacuate(v->body);
+        return;
+    }
+
+    if (mothval_is_inline(v)) {
+        for (int i = 0; i < v->count; i++) {
+            v->cell[i] = mgc_evacuate(v->cell[i]);
+        }
+    } else {
+        mcells *b = mothval_block(v);
+        int off = v->cell - b->items;
+        b = mgc_evacuate_cells(b);
+        mothval_block(v) = b;
+        v->cell = b->items + off;
+
+        /* The block owns every value in it, not only the window */
+        for (int i = b->lo; i < b->hi; i++) {
+            b->items[i] = mgc_evacuate(b->items[i]);
+        }
+    }
+
+    if (v->code) {
+        for (int i = 0; i < v->code->nconsts; i++) {
+            v->code->consts[i] = mgc_evacuate(v->code->consts[i]);
+        }
+    }
+}
+
+/* Promote everything in the nursery that is still reachable and start
+   it over */
+void mgc_minor(menv *e)
+{
+    double start = moth_now();
+
+    mgc_visit_roots(e, mgc_evacuate_root);
+    for (size_t i = 0; i < mgc_remembered.count; i++) {
+        mothval *v = mgc_remembered.items[i];
+        v->refs &= ~MGC_REMEMBERED;
+        mgc_scan(v);
+    }
+    mgc_remembered.count = 0;
+    for (size_t i = 0; i < mgc_new_chunks.count; i++) {
+        mchunk *c = mgc_new_chunks.items[i];
+        for (int j = 0; j < c->nconsts; j++) {
+            c->consts[j] = mgc_evacuate(c->consts[j]);
+        }
+    }
+
+    while (mgc_gray.count) { mgc_scan(mgc_gray.items[--mgc_gray.count]); }
+
+    for (size_t i = 0; i < mgc_new_chunks.count; i++) {
+        mchunk_release(mgc_new_chunks.items[i]);
+    }
+    mgc_new_chunks.count = 0;
+
+    /* Values left behind let go of their chunks */
+    for (size_t i = 0; i < mgc_young_code.count; i++) {
+        mothval *v = mgc_young_code.items[i];
+        if (!(v->refs & MGC_FORWARD)) { mchunk_release(v->code); }
+    }
+    mgc_young_code.count = 0;
+
+    /* Keep one block of nursery for the next round */
+    while (mgc_nursery && mgc_nursery->next) {
+        mmem_block *b = mgc_nursery;
+        mgc_nursery = b->next;
+        free(b);
+    }
+    if (mgc_nursery) { mgc_nursery->used = 0; }
+    mgc_nursery_used = 0;
+
+    double pause = moth_now() - start;
+    int bucket = 0;
+    while (bucket < MGC_BUCKETS - 1 && pause * 1e3 >= 1 << bucket) { bucket++; }
+    mgc_minor_pauses[bucket]++;
+    mgc_minors++;
+    mgc_minor_total += pause;
+}
+
+/* Major collection */
+
+static void mgc_mark(mothval *v)
+{
+    if (mothval_is_imm(v) || (v->refs & MGC_MARK)) { return; }
+    v->refs |= MGC_MARK;
+    if (v->type == MOTHVAL_SEXPR || v->type == MOTHVAL_QEXPR
+        || v->type == MOTHVAL_LAMBDA) {
+        mgc_push(&mgc_gray, v);
+    }
+}
+
+static void mgc_mark_root(mothval **slot) { mgc_mark(*slot); }
+
+/* Mark everything reachable from the gray lists, without recursing so
+   that deep nesting cannot overflow the C stack */
+static void mgc_drain(void)
+{
+    while (mgc_gray.count) {
+        mothval *v = mgc_gray.items[--mgc_gray.count];
+
+        if (v->type == MOTHVAL_LAMBDA) {
+            mgc_mark(v->formals);
+            mgc_mark(v->body);
+            continue;
+        }
+
+        if (mothval_is_inline(v)) {
+            for (int i = 0; i < v->count; i++) { mgc_mark(v->cell[i]); }
+        } else {
+            mcells *b = mothval_block(v);
+            b->flags |= MGC_MARK;
+            for (int i = b->lo; i < b->hi; i++) { mgc_mark(b->items[i]); }
+        }
+
+        if (v->code) {
+            for (int i = 0; i < v->code->nconsts; i++) {
+                mgc_mark(v->code->consts[i]);
+            }
+        }
+    }
+}
+
+/* Empty the nursery, then free every old node and block not reachable
+   from 'e' or the VM, and record the cycle. With no environment
+   everything is freed */
+void mgc_collect(menv *e)
+{
+    mgc_minor(e);
+
+    double start = moth_now();
+
+    mgc_visit_roots(e, mgc_mark_root);
+    mgc_drain();
+
+    size_t reclaimed = 0, live = 0, n = 0;
+
+    for (size_t i = 0; i < mgc_vals.count; i++) {
+        mothval *v = mgc_vals.items[i];
+        size_t size = mothval_size(v);
+        if (v->refs & MGC_MARK) {
+            v->refs &= ~MGC_MARK;
+            mgc_vals.items[n++] = v;
+            live += size;
+            continue;
+        }
+        if (v->type == MOTHVAL_SEXPR || v->type == MOTHVAL_QEXPR) {
+            mchunk_release(v->code);
+        }
+        mmem_free(v, size);
+        reclaimed += size;
+    }
+    mgc_vals.count = n;
+
+    n = 0;
+    for (size_t i = 0; i < mgc_cells.count; i++) {
+        mcells *b = mgc_cells.items[i];
+        size_t size = MCELLS_SIZE(b->cap);
+        if (b->flags & MGC_MARK) {
+            b->flags &= ~MGC_MARK;
+            mgc_cells.items[n++] = b;
+            live += size;
+            continue;
+        }
+        mmem_free(b, size);
+        reclaimed += size;
+    }
+    mgc_cells.count = n;
+
+    /* Let the old space double before the next major collection */
+    mgc_allocated = 0;
+    mgc_threshold = live > MGC_MIN_HEAP ? live : MGC_MIN_HEAP;
+
+    double pause = moth_now() - start;
+
+    mgc_cycle *c = &mgc_history[mgc_cycles % MGC_HISTORY];
+    c->cycle = ++mgc_cycles;
+    c->pause = pause;
+    c->reclaimed = reclaimed;
+    c->live = live;
+
+    mgc_pause_total += pause;
+    if (pause > mgc_pause_max) { mgc_pause_max = pause; }
+    mgc_reclaimed += reclaimed;
+}
+
+/* Safe point: collect whichever generations have filled up */
+void mgc_poll(menv *e)
+{
+    if (!moth_gc) { return; }
+    if (mgc_allocated > mgc_threshold) { mgc_collect(e); return; }
+
+    /* Leave room for the next step of evaluation to run without having
+       to chain on another block */
+    if (mgc_nursery_used >= MGC_NURSERY / 4 * 3) { mgc_minor(e); }
+}
+
+void mgc_print_stats(void)
+{
+    printf("minor cycles:   %ld\n", mgc_minors);
+    printf("minor pauses:   %.3f ms\n", mgc_minor_total);
+    printf("promoted:       %zu bytes\n", mgc_promoted);
+    for (int i = 0; i < MGC_BUCKETS; i++) {
+        if (!mgc_minor_pauses[i]) { continue; }
+        printf("  under %7ld us: %ld\n", 1L << i, mgc_minor_pauses[i]);
+    }
+
+    printf("major cycles:   %ld\n", mgc_cycles);
+    printf("major pauses:   %.3f ms (max %.3f ms)\n",
+           mgc_pause_total, mgc_pause_max);
+    printf("reclaimed:      %zu bytes\n", mgc_reclaimed);
+
+    long first = mgc_cycles > MGC_HISTORY ? mgc_cycles - MGC_HISTORY : 0;
+    for (long i = first; i < mgc_cycles; i++) {
+        mgc_cycle *c = &mgc_history[i % MGC_HISTORY];
+        printf("  cycle %ld: pause %.3f ms, reclaimed %zu bytes, live %zu bytes\n",
+               c->cycle, c->pause, c->reclaimed, c->live);
+    }
+}
+
+/* Make room on the value stack for running 'c' */
+static void mvm_reserve(mchunk *c)
+{
+    if (mvm_sp + c->depth > mvm_cap) {
+        while (mvm_sp + c->depth > mvm_cap) {
+            mvm_cap = mvm_cap ? mvm_cap * 2 : 256;
+        }
+        mvm_stack = realloc(mvm_stack, sizeof(mothval *) * mvm_cap);
+    }
+}
+
+/* Whether chunk 'c' was compiled for an environment shaped like 'e' */
+static int mvm_fits(mchunk *c, menv *e)
+{
+    if (c->root != menv_root(e)->id) { return 0; }
+    if (!e->par) { return c->nscope == 0; }
+    return c->nscope == e->count
+        && memcmp(c->scope, e->syms, sizeof(msym *) * e->count) == 0;
+}
+
+/* The chunk that evaluates the cells of list 'v' in 'e'. Sets '*dyn' if
+   it has to look names up by symbol there */
+static mchunk *mvm_code_locked(mothval *v, menv *e, int *dyn)
+{
+    mchunk *c = v->code;
+    *dyn = 0;
+
+    if (!c) {
+        c = mvm_compile(v, e);
+        __atomic_store_n(&v->code, c, __ATOMIC_RELEASE);
+        mgc_barrier(v);
+    } else if (!mvm_fits(c, e)) {
+        if (c->ran) {
+            *dyn = 1;
+            return c;
+        }
+
+        /* A chunk that has not run yet, like the body of a lambda that
+           was compiled as a quoted list, is compiled again for where it
+           is first run. That is done in place, as the copies sharing it
+           are most likely run there too */
+        mchunk *x = mvm_compile(v, e);
+        mchunk old = *c;
+
+        /* Another thread may be taking a reference meanwhile, so the
+           counts stay where they are */
+        size_t off = offsetof(mchunk, count);
+        memcpy((char *)c + off, (char *)x + off, sizeof(mchunk) - off);
+        memcpy((char *)x + off, (char *)&old + off, sizeof(mchunk) - off);
+        mchunk_release(x);
+        mgc_remember_chunk(c);
+    }
+
+    __atomic_store_n(&c->ran, 1, __ATOMIC_RELEASE);
+    return c;
+}
+
+static mchunk *mvm_code(mothval *v, menv *e, int *dyn)
+{
+    if (moth_threads < 2) { return mvm_code_locked(v, e, dyn); }
+
+    /* A chunk that has run is never changed again, so it can be used
+       without the lock */
+    mchunk *c = __atomic_load_n(&v->code, __ATOMIC_ACQUIRE);
+    if (c && __atomic_load_n(&c->ran, __ATOMIC_ACQUIRE)) {
+        *dyn = !mvm_fits(c, e);
+        return c;
+    }
+
+    pthread_mutex_lock(&mpar_lock);
+    c = mvm_code_locked(v, e, dyn);
+    pthread_mutex_unlock(&mpar_lock);
+    return c;
+}
+
+/* The binding that global read 'g' finds in 'e', for a chunk that was
+   compiled for somewhere else. If a parameter of the call frame has the
+   name instead, its value is put in '*x' */
+static mbind *mvm_global_bind(mvm_global *g, menv *e, mothval **x)
+{
+    msym *s = g->bind->sym;
+    for (int i = 0; e->par && i < e->count; i++) {
+        if (e->syms[i] == s) { *x = mothval_copy(e->vals[i]); return NULL; }
+    }
+
+    /* Threads would race to update the cache, so they look it up */
+    menv *root = menv_root(e);
+    if (moth_threads > 1) {
+        pthread_mutex_lock(&mpar_lock);
+        mbind *b = root->count ? root->binds[menv_slot(root, s)] : NULL;
+        pthread_mutex_unlock(&mpar_lock);
+        if (!b) { *x = mothval_error(MERR_UNBOUND); }
+        return b;
+    }
+
+    if (g->root == root->id) {
+        mvm_stats.cache_hits++;
+    } else {
+        mvm_stats.cache_misses++;
+        g->root = root->id;
+        g->cached = menv_bind(root, s);
+    }
+    return g->cached;
+}
+
+/*
+ * Parallel evaluation
+ *
+ * With -p N there are N threads: the one running the REPL and N - 1
+ * workers. Each has a deque of tasks. A thread pushes the tasks it forks
+ * onto the bottom of its own and pops them from there, most recent
+ * first, while idle threads steal from the top of the others', oldest
+ * first. Workers with nothing to steal sleep until something is pushed.
+ *
+ * OP_PAR forks a task for each cell of a call that is a call itself,
+ * and evaluates the others in place, only when some thread is idle, its
+ * own deque is empty, and the cells only compute values and one of the
+ * calls among them reaches a lambda. Otherwise the code for the cells
+ * runs as usual, so that small calls and busy pools cost a check and
+ * nothing more.
+ *
+ * Results go back in the order of the cells, and the error of the first
+ * cell that fails is the call's, as it would have been one cell after
+ * another. Once a cell fails, the tasks for the cells after it are
+ * cancelled: one that has not started does nothing, and one that has,
+ * along with everything it forked, fails at its next call.
+ */
+
+#define MPAR_MAX_THREADS 64
+
+/* How deeply tasks run within each other on one thread, which bounds the
+   C stack a thread waiting for its tasks uses to run others */
+#define MPAR_MAX_DEPTH 16
+
+/* Values looked at before giving up on showing a call is pure */
+#define MPAR_SCAN_BUDGET 4096
+
+struct mpar_task;
+
+/* Tasks forked together. 'failed' is the lowest index of one that
+   failed, or INT_MAX, and 'parent' the task they were forked from */
+typedef struct {
+    int failed;
+    int left;
+    struct mpar_task *parent;
+} mpar_group;
+
+/* Work for a thread: 'run' computes 'result' from the rest. A task
+   over a list applies 'f' to its cells lo..hi, and may put what it
+   makes for each in 'out' */
+typedef struct mpar_task {
+    mothval *(*run)(struct mpar_task *t);
+    menv *e;
+    mothval *v;
+    mothval *result;
+    int index;
+    mpar_group *g;
+
+    mothval *f;
+    int lo;
+    int hi;
+    mothval **out;
+} mpar_task;
+
+/* Tasks waiting in items[head..tail) */
+typedef struct {
+    pthread_mutex_t lock;
+    mpar_task **items;
+    int head;
+    int tail;
+    int cap;
+} mpar_deque;
+
+static mpar_deque mpar_deques[MPAR_MAX_THREADS];
+static int mpar_nthreads = 1;
+
+/* Workers asleep, and tasks waiting in any deque */
+static int mpar_idle = 0;
+static int mpar_queued = 0;
+static pthread_mutex_t mpar_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mpar_wake = PTHREAD_COND_INITIALIZER;
+
+/* The thread's deque, how many tasks it is running within each other,
+   and the innermost of them */
+static _Thread_local int mpar_self = 0;
+static _Thread_local int mpar_depth = 0;
+static _Thread_local mpar_task *mpar_cur = NULL;
+
+/* Set on the thread that started the pool and on its workers. Other
+   threads run their contexts' calls in order */
+static _Thread_local int mpar_member = 0;
+
+/* Calls evaluated in parallel, by any thread */
+static long mpar_calls = 0;
+
+/* Push the 'n' tasks at 't' onto this thread's deque, last first, so
+   that the first is popped first */
+static void mpar_push(mpar_task **t, int n)
+{
+    mpar_deque *d = &mpar_deques[mpar_self];
+    pthread_mutex_lock(&d->lock);
+    if (d->tail + n > d->cap) {
+        while (d->tail + n > d->cap) { d->cap = d->cap ? d->cap * 2 : 64; }
+        d->items = realloc(d->items, sizeof(mpar_task *) * d->cap);
+    }
+    for (int i = n - 1; i >= 0; i--) { d->items[d->tail + n - 1 - i] = t[i]; }
+    __atomic_store_n(&d->tail, d->tail + n, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&d->lock);
+
+    __atomic_add_fetch(&mpar_queued, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mpar_idle, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&mpar_idle_lock);
+        pthread_cond_broadcast(&mpar_wake);
+        pthread_mutex_unlock(&mpar_idle_lock);
+    }
+}
+
+/* Take a task from the bottom of this thread's deque, or from the top of
+   deque 'i' if it is another's, or return NULL if it is empty */
+static mpar_task *mpar_take(int i)
+{
+    mpar_deque *d = &mpar_deques[i];
+    if (__atomic_load_n(&d->tail, __ATOMIC_RELAXED) == 0) { return NULL; }
+
+    mpar_task *t = NULL;
+    pthread_mutex_lock(&d->lock);
+    int head = d->head, tail = d->tail;
+    if (head < tail) {
+        t = i == mpar_self ? d->items[--tail] : d->items[head++];
+        if (head == tail) { head = tail = 0; }
+        d->head = head;
+        __atomic_store_n(&d->tail, tail, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    if (t) { __atomic_sub_fetch(&mpar_queued, 1, __ATOMIC_SEQ_CST); }
+    return t;
+}
+
+/* Steal a task from another thread */
+static mpar_task *mpar_steal(void)
+{
+    int n = __atomic_load_n(&mpar_nthreads, __ATOMIC_ACQUIRE);
+    for (int k = 1; k < n; k++) {
+        mpar_task *t = mpar_take((mpar_self + k) % n);
+        if (t) { return t; }
+    }
+    return NULL;
+}
+
+/* Whether task 't', or one it was forked from, comes after a task of
+   its own group that failed */
+static int mpar_cancelled(mpar_task *t)
+{
+    for (; t; t = t->g->parent) {
+        if (__atomic_load_n(&t->g->failed, __ATOMIC_ACQUIRE) < t->index) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void mpar_run(mpar_task *t)
+{
+    mpar_task *outer = mpar_cur;
+    mpar_cur = t;
+    mpar_depth++;
+
+    mothval *x = mpar_cancelled(t) ? mothval_error(MERR_CANCELLED) : t->run(t);
+    t->result = x;
+
+    if (mothval_type(x) == MOTHVAL_ERR) {
+        int failed = __atomic_load_n(&t->g->failed, __ATOMIC_RELAXED);
+        while (t->index < failed && !__atomic_compare_exchange_n(
+                   &t->g->failed, &failed, t->index, 0,
+                   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    }
+
+    mpar_depth--;
+    mpar_cur = outer;
+
+    /* The group may be gone once the last task is done */
+    __atomic_sub_fetch(&t->g->left, 1, __ATOMIC_ACQ_REL);
+}
+
+static void *mpar_worker(void *arg)
+{
+    mpar_self = (int)(intptr_t)arg;
+    mpar_member = 1;
+
+    for (;;) {
+        mpar_task *t = mpar_take(mpar_self);
+        if (!t) { t = mpar_steal(); }
+        if (t) {
+            mpar_run(t);
+            continue;
+        }
+
+        pthread_mutex_lock(&mpar_idle_lock);
+        __atomic_add_fetch(&mpar_idle, 1, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&mpar_queued, __ATOMIC_SEQ_CST)) {
+            pthread_cond_wait(&mpar_wake, &mpar_idle_lock);
+        }
+        __atomic_sub_fetch(&mpar_idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&mpar_idle_lock);
+    }
+    return NULL;
+}
+
+/* Whether this thread can fork tasks: it is one of the pool's, not too
+   deep in tasks, and has none of its own waiting, which may belong to
+   another group */
+static int mpar_can_fork(void)
+{
+    return moth_threads > 1 && mpar_member && mpar_depth < MPAR_MAX_DEPTH
+        && !__atomic_load_n(&mpar_deques[mpar_self].tail, __ATOMIC_RELAXED);
+}
+
+/* Run the tasks of group 'g', which this thread pushed, until they are
+   all done. Tasks stolen from it are waited for by running others */
+static void mpar_join(mpar_group *g)
+{
+    while (__atomic_load_n(&g->left, __ATOMIC_ACQUIRE) > 0) {
+        mpar_task *t = mpar_take(mpar_self);
+        if (!t && mpar_depth < MPAR_MAX_DEPTH) { t = mpar_steal(); }
+        if (t) {
+            mpar_run(t);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/* Evaluate the cells of calls on 'n' threads in all, starting workers
+   for those there are not yet */
+void mpar_start(int n)
+{
+    if (n > MPAR_MAX_THREADS) { n = MPAR_MAX_THREADS; }
+    mpar_member = 1;
+    if (mpar_nthreads == 1 && n > 1) {
+        pthread_mutex_init(&mpar_deques[0].lock, NULL);
+    }
+
+    while (mpar_nthreads < n) {
+        int i = mpar_nthreads;
+        pthread_mutex_init(&mpar_deques[i].lock, NULL);
+        __atomic_store_n(&mpar_nthreads, i + 1, __ATOMIC_RELEASE);
+
+        pthread_t t;
+        pthread_create(&t, NULL, mpar_worker, (void *)(intptr_t)i);
+        pthread_detach(t);
+    }
+    if (n > moth_threads) { moth_threads = n; }
+}
+
+/* Whether 'f' only computes a value from its arguments, so that calls
+   of it can run at once */
+static int mpar_safe(mbuiltin f)
+{
+    return mvm_pure(f) || f == builtin_if || f == builtin_eval
+        || f == builtin_lambda || f == builtin_map || f == builtin_filter
+        || f == builtin_fold || f == builtin_pmap || f == builtin_preduce;
+}
+
+/* Values waiting to be looked at by mpar_scan, and the globals it has
+   already looked at. Only used with mpar_lock held */
+typedef struct {
+    mothval *v;
+    int local;
+} mpar_item;
+
+static mpar_item *mpar_items = NULL;
+static int mpar_nitems = 0;
+static int mpar_items_cap = 0;
+
+static msym **mpar_seen = NULL;
+static int mpar_nseen = 0;
+static int mpar_seen_cap = 0;
+
+/* Queue 'v' to be looked at. A symbol in it is a variable of the frame
+   being evaluated in if 'local' is set, and a global otherwise */
+static void mpar_scan_push(mothval *v, int local)
+{
+    if (mpar_nitems == mpar_items_cap) {
+        mpar_items_cap = mpar_items_cap ? mpar_items_cap * 2 : 64;
+        mpar_items = realloc(mpar_items, sizeof(mpar_item) * mpar_items_cap);
+    }
+    mpar_items[mpar_nitems].v = v;
+    mpar_items[mpar_nitems].local = local;
+    mpar_nitems++;
+}
+
+/* Whether the queued values only use builtins that are safe to run at
+   once, through the globals they name and the lambdas those are bound
+   to, looking at no more than 'budget' nodes. Adds the frame variables
+   of chunk 'c' that they name to '*slots', and sets '*heavy' if they
+   reach a lambda */
+static int mpar_scan(menv *root, mchunk *c, int budget, uint64_t *slots,
+                     int *heavy)
+{
+    int pure = 1;
+    mpar_nseen = 0;
+
+    while (pure && mpar_nitems > 0) {
+        mpar_item it = mpar_items[--mpar_nitems];
+        mothval *v = it.v;
+        if (!mothval_is_imm(v) && --budget < 0) { pure = 0; break; }
+
+        switch (mothval_type(v)) {
+        case MOTHVAL_SYM: {
+            int k = -1;
+            for (int i = 0; it.local && i < c->nscope; i++) {
+                if (c->scope[i] == v->sym) { k = i; }
+            }
+            if (k >= 64) { pure = 0; break; }
+            if (k >= 0) { *slots |= (uint64_t)1 << k; break; }
+
+            int seen = 0;
+            for (int i = 0; i < mpar_nseen; i++) {
+                if (mpar_seen[i] == v->sym) { seen = 1; break; }
+            }
+            if (seen || root->count == 0) { break; }
+            if (mpar_nseen == mpar_seen_cap) {
+                mpar_seen_cap = mpar_seen_cap ? mpar_seen_cap * 2 : 64;
+                mpar_seen = realloc(mpar_seen, sizeof(msym *) * mpar_seen_cap);
+            }
+            mpar_seen[mpar_nseen++] = v->sym;
+
+            int i = menv_slot(root, v->sym);
+            if (root->syms[i] && root->binds[i]->val) {
+                mpar_scan_push(root->binds[i]->val, 0);
+            }
+            break;
+        }
+
+        case MOTHVAL_FUN:
+            if (!mpar_safe(v->fun)) { pure = 0; }
+            break;
+
+        /* Its parameters are taken for globals too, which can only make
+           it look less pure than it is */
+        case MOTHVAL_LAMBDA: {
+            *heavy = 1;
+            mpar_scan_push(v->body, 0);
+            int captured = (v->formals->count - v->count) / 2;
+            for (int i = v->count + captured; i < v->formals->count; i++) {
+                mpar_scan_push(v->formals->cell[i], 0);
+            }
+            break;
+        }
+
+        case MOTHVAL_SEXPR:
+        case MOTHVAL_QEXPR:
+            for (int i = 0; i < v->count; i++) {
+                mpar_scan_push(v->cell[i], it.local);
+            }
+            break;
+        }
+    }
+
+    mpar_nitems = 0;
+    return pure;
+}
+
+/* Find out again what call 'p' of chunk 'c' does in global environment
+   'root', and publish it. Only used with mpar_lock held */
+static void mpar_decide(mchunk *c, mvm_par *p, menv *root)
+{
+    mothval *v = c->consts[p->k];
+    int pure = 1;
+    int heavy = 0;
+    uint64_t slots = 0;
+    uint64_t call_slots = 0;
+
+    /* A cell that is not a call, such as the function called, is only
+       looked up, however much work calling it is */
+    for (int i = 0; pure && i < v->count; i++) {
+        int h = 0;
+        uint64_t s = 0;
+        mpar_scan_push(v->cell[i], 1);
+        pure = mpar_scan(root, c, MPAR_SCAN_BUDGET, &s, &h);
+        slots |= s;
+        if (mvm_is_call(v->cell[i])) {
+            heavy |= h;
+            call_slots |= s;
+        }
+    }
+
+    unsigned seq = p->seq;
+    __atomic_store_n(&p->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->pure, pure, __ATOMIC_RELEASE);
+    __atomic_store_n(&p->heavy, heavy, __ATOMIC_RELEASE);
+    __atomic_store_n(&p->slots, slots, __ATOMIC_RELEASE);
+    __atomic_store_n(&p->call_slots, call_slots, __ATOMIC_RELEASE);
+    __atomic_store_n(&p->root, root->id, __ATOMIC_RELEASE);
+    __atomic_store_n(&p->defs, root->defs, __ATOMIC_RELEASE);
+    __atomic_store_n(&p->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Whether call 'p' of chunk 'c' is worth evaluating in parallel in 'e' */
+static int mpar_worth(mchunk *c, mvm_par *p, menv *e)
+{
+    menv *root = menv_root(e);
+
+    /* Read the decision without the lock, and take it only to make a
+       new one, or to wait for one being made. Each part of a decision is
+       stored after its 'seq' is made odd, so a part read from a newer
+       one than 'seq' was read from shows in 'seq' read again after */
+    unsigned seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+    int pure = __atomic_load_n(&p->pure, __ATOMIC_ACQUIRE);
+    int heavy = __atomic_load_n(&p->heavy, __ATOMIC_ACQUIRE);
+    uint64_t slots = __atomic_load_n(&p->slots, __ATOMIC_ACQUIRE);
+    uint64_t call_slots = __atomic_load_n(&p->call_slots, __ATOMIC_ACQUIRE);
+    unsigned long proot = __atomic_load_n(&p->root, __ATOMIC_ACQUIRE);
+    unsigned long defs = __atomic_load_n(&p->defs, __ATOMIC_ACQUIRE);
+
+    if ((seq & 1) || __atomic_load_n(&p->seq, __ATOMIC_RELAXED) != seq
+        || proot != root->id || defs != root->defs) {
+        pthread_mutex_lock(&mpar_lock);
+        if (p->root != root->id || p->defs != root->defs) {
+            mpar_decide(c, p, root);
+        }
+        pure = p->pure;
+        heavy = p->heavy;
+        slots = p->slots;
+        call_slots = p->call_slots;
+        pthread_mutex_unlock(&mpar_lock);
+    }
+    if (!pure) { return 0; }
+
+    /* The values of the frame's variables change with every call. A
+       number can neither do anything nor reach a lambda, so only other
+       values are looked at, and only if they could change the answer */
+    uint64_t vals = 0;
+    for (int k = 0; k < c->nscope; k++) {
+        if ((slots >> k & 1) && !mothval_is_imm(e->vals[k])) {
+            vals |= (uint64_t)1 << k;
+        }
+    }
+    if (!vals) { return heavy; }
+    if (!heavy && !(vals & call_slots)) { return 0; }
+
+    pthread_mutex_lock(&mpar_lock);
+    for (int k = 0; pure && k < c->nscope; k++) {
+        if (!(vals >> k & 1)) { continue; }
+        int h = 0;
+        uint64_t none = 0;
+        mpar_scan_push(e->vals[k], 0);
+        pure = mpar_scan(root, c, MPAR_SCAN_BUDGET, &none, &h);
+        if (call_slots >> k & 1) { heavy |= h; }
+    }
+    pthread_mutex_unlock(&mpar_lock);
+    return pure && heavy;
+}
+
+/* Whether applying 'f' to the cells of list 'l' in 'e' only computes
+   values. The cells are data, but 'f' may evaluate them */
+static int mpar_pure_apply(menv *e, mothval *f, mothval *l)
+{
+    int heavy = 0;
+    uint64_t slots = 0;
+    pthread_mutex_lock(&mpar_lock);
+    mpar_scan_push(f, 0);
+    mpar_scan_push(l, 0);
+    int pure = mpar_scan(menv_root(e), NULL, MPAR_SCAN_BUDGET + l->count,
+                         &slots, &heavy);
+    pthread_mutex_unlock(&mpar_lock);
+    return pure;
+}
+
+void mvm_print_stats(void)
+{
+    printf("global reads: %ld\n", mvm_stats.global_reads);
+    printf("cache hits:   %ld\n", mvm_stats.cache_hits);
+    printf("cache misses: %ld\n", mvm_stats.cache_misses);
+    if (moth_threads > 1) {
+        printf("par calls:    %ld\n",
+               __atomic_load_n(&mpar_calls, __ATOMIC_RELAXED));
+    }
+}
+
+mothval *mvm_run(menv *e, mchunk *c, int dyn);
+
+/* Evaluate the cell of a call in task 't' */
+static mothval *mpar_eval(mpar_task *t)
+{
+    int dyn;
+    mchunk *c = mvm_code(t->v, t->e, &dyn);
+    return mvm_run(t->e, c, dyn);
+}
+
+/* Evaluate the cells of call 'p' of chunk 'c' in 'e' in parallel and
+   push their values, if that is worth it. Returns whether it was done,
+   with the error of the first cell to fail in '*err' if one did */
+static int mpar_call(mchunk *c, mvm_par *p, menv *e, mothval **err)
+{
+    if (!__atomic_load_n(&mpar_idle, __ATOMIC_RELAXED) || !mpar_can_fork()
+        || !mpar_worth(c, p, e)) {
+        return 0;
+    }
+
+    __atomic_add_fetch(&mpar_calls, 1, __ATOMIC_RELAXED);
+    mothval *v = c->consts[p->k];
+    int n = v->count;
+    mpar_task few[8];
+    mpar_task *few_calls[8];
+    mpar_task *t = n <= 8 ? few : malloc(sizeof(mpar_task) * n);
+    mpar_task **calls = n <= 8 ? few_calls : malloc(sizeof(mpar_task *) * n);
+    mpar_group g = { INT_MAX, 0, mpar_cur };
+
+    /* Cells that are not calls are evaluated here and now, stopping at
+       the first to fail. Calls after it are not evaluated at all, and
+       those before it may still fail first */
+    for (int i = 0; i < n; i++) {
+        mothval *x = mvm_expr(v->cell[i]);
+        t[i].result = NULL;
+        if (g.failed != INT_MAX) { continue; }
+
+        if (mvm_is_call(x)) {
+            t[i].run = mpar_eval;
+            t[i].e = e;
+            t[i].v = x;
+            t[i].index = i;
+            t[i].g = &g;
+            calls[g.left++] = &t[i];
+            continue;
+        }
+
+        switch (mothval_type(x)) {
+        case MOTHVAL_SYM: x = menv_lookup(e, x->sym); break;
+        case MOTHVAL_SEXPR: x = mothval_sexpr(); break;
+        default: x = mothval_copy(x); break;
+        }
+        t[i].result = x;
+        if (mothval_type(x) == MOTHVAL_ERR) { g.failed = i; }
+    }
+
+    if (g.left > 0) {
+        mpar_push(calls, g.left);
+        mpar_join(&g);
+    }
+
+    if (g.failed != INT_MAX) {
+        *err = t[g.failed].result;
+        t[g.failed].result = NULL;
+    }
+    for (int i = 0; i < n; i++) {
+        if (g.failed != INT_MAX) {
+            if (t[i].result) { mothval_del(t[i].result); }
+        } else {
+            mvm_stack[mvm_sp++] = t[i].result;
+        }
+    }
+
+    if (t != few) { free(t); free(calls); }
+    return 1;
+}
+
+/* Start running chunk 'c' in 'e' on top of the frame stack */
+static void mvm_enter(mchunk *c, menv *e, int dyn)
+{
+    mvm_reserve(c);
+
+    if (mvm_nframes == mvm_frames_cap) {
+        mvm_frames_cap = mvm_frames_cap ? mvm_frames_cap * 2 : 64;
+        mvm_frames = realloc(mvm_frames, sizeof(mvm_frame) * mvm_frames_cap);
+    }
+    mvm_frame *fp = &mvm_frames[mvm_nframes++];
+    fp->c = c;
+    fp->e = e;
+    fp->sp = mvm_sp;
+    fp->dyn = dyn;
+}
+
+mothval *mvm_run(menv *e, mchunk *c, int dyn)
+{
+    /* A builtin can run the VM again from in here, so this run returns
+       once the frames above where it started are done */
+    int base = mvm_nframes;
+    mvm_enter(c, e, dyn);
+    mvm_frame *fp;
+    mothval *x;
+
+    /* Call frame of a lambda running in place of the chunk, which is
+       freed when the chunk is done with it */
+    menv *frame = NULL;
+
+    /* Keep the chunk alive even if running it redefines its owner */
+    mchunk_retain(c);
+    unsigned char *ip = c->code;
+    int arg;
+
+#define READ_ARG() (memcpy(&arg, ip, sizeof(int)), ip += sizeof(int), arg)
+
+#if defined(__GNUC__)
+    static void *dispatch[] = {
+        &&op_OP_CONST, &&op_OP_LOCAL, &&op_OP_GLOBAL, &&op_OP_CALL,
+        &&op_OP_RETURN, &&op_OP_FAIL, &&op_OP_FOLD, &&op_OP_SKIP,
+        &&op_OP_PAR
+    };
+#define VM_CASE(op) op_##op:
+#define VM_NEXT()   goto *dispatch[*ip++]
+    VM_NEXT();
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT()   continue
+    for (;;) switch (*ip++) {
+#endif
+
+    VM_CASE(OP_CONST) {
+        mvm_stack[mvm_sp++] = mothval_copy(c->consts[READ_ARG()]);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_LOCAL) {
+        int k = READ_ARG();
+        if (dyn) {
+            x = menv_lookup(e, c->scope[k]);
+            if (mothval_type(x) == MOTHVAL_ERR) { goto fail; }
+        } else {
+            x = mothval_copy(e->vals[k]);
+        }
+        mvm_stack[mvm_sp++] = x;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_GLOBAL) {
+        mvm_global *g = &c->globals[READ_ARG()];
+        mbind *b = g->bind;
+        x = NULL;
+        if (dyn) {
+            b = mvm_global_bind(g, e, &x);
+        } else {
+            mvm_stats.global_reads++;
+        }
+        if (!x) {
+            x = b->val ? mothval_copy(b->val) : mothval_error(MERR_UNBOUND);
+        }
+        if (mothval_type(x) == MOTHVAL_ERR) { goto fail; }
+        mvm_stack[mvm_sp++] = x;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_CALL) {
+        mgc_poll(e);
+
+        /* A task whose value is no longer needed stops here */
+        if (mpar_cur && mpar_cancelled(mpar_cur)) {
+            x = mothval_error(MERR_CANCELLED);
+            goto fail;
+        }
+
+        int n = READ_ARG();
+        mvm_sp -= n;
+        mothval **args = &mvm_stack[mvm_sp];
+
+        if (mothval_type(args[0]) != MOTHVAL_FUN
+            && mothval_type(args[0]) != MOTHVAL_LAMBDA) {
+            for (int i = 0; i < n; i++) { mothval_del(args[i]); }
+            x = mothval_error(MERR_NOT_FUNCTION);
+            goto fail;
+        }
+
+        /* Move the arguments off the stack before calling, as the
+           builtin may run the VM again */
+        mothval *f = args[0];
+        mothval *a = mothval_sexpr();
+        mothval_append(a, &args[1], n - 1);
+
+        x = mothval_call(e, f, a);
+        mothval_del(f);
+
+        if (x == MOTHVAL_TAIL) {
+            mothval *body = mtail_expr;
+            menv *te = mtail_env;
+            int new_frame = mtail_frame;
+            int next_dyn;
+            mchunk *next = mchunk_retain(mvm_code(body, te, &next_dyn));
+            mothval_del(body);
+
+            if (*ip == OP_RETURN) {
+                /* A call in tail position replaces this chunk, and a new
+                   call frame replaces the one this run owns */
+                mchunk_release(c);
+                if (new_frame) {
+                    if (frame) { menv_del(frame); }
+                    frame = te;
+                }
+                c = next;
+                e = te;
+                dyn = next_dyn;
+                ip = c->code;
+                mvm_reserve(c);
+                fp = &mvm_frames[mvm_nframes - 1];
+                fp->c = c;
+                fp->e = e;
+                fp->dyn = dyn;
+                VM_NEXT();
+            }
+
+            /* Otherwise it runs above this chunk, which carries on
+               from here once it returns */
+            fp = &mvm_frames[mvm_nframes - 1];
+            fp->ip = ip;
+            fp->frame = frame;
+            frame = new_frame ? te : NULL;
+            c = next;
+            e = te;
+            dyn = next_dyn;
+            ip = c->code;
+            mvm_enter(c, e, dyn);
+            VM_NEXT();
+        }
+
+        if (mothval_type(x) == MOTHVAL_ERR) { goto fail; }
+        mvm_stack[mvm_sp++] = x;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_RETURN) {
+        mchunk_release(c);
+        if (frame) { menv_del(frame); }
+        if (--mvm_nframes == base) { return mvm_stack[--mvm_sp]; }
+
+        /* The value is left on the stack where the call put its result */
+        fp = &mvm_frames[mvm_nframes - 1];
+        c = fp->c;
+        e = fp->e;
+        ip = fp->ip;
+        frame = fp->frame;
+        dyn = fp->dyn;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_FAIL) {
+        x = mothval_copy(c->consts[READ_ARG()]);
+        goto fail;
+    }
+
+    VM_CASE(OP_FOLD) {
+        x = c->consts[READ_ARG()];
+
+        /* Under another environment the names may mean something else */
+        if (dyn || menv_root(e)->redefs != c->redefs) {
+            ip += 1 + sizeof(int);
+            VM_NEXT();
+        }
+        mvm_stack[mvm_sp++] = mothval_copy(x);
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_SKIP) {
+        int n = READ_ARG();
+        ip += n;
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_PAR) {
+        mvm_par *p = &c->pars[READ_ARG()];
+        x = NULL;
+
+        /* Other threads would not find the names where the chunk does */
+        if (dyn || !mpar_call(c, p, e, &x)) {
+            ip += 1 + sizeof(int);
+            VM_NEXT();
+        }
+        if (x) { goto fail; }
+        VM_NEXT();
+    }
+
+#if !defined(__GNUC__)
+    }
+#endif
+
+fail:
+    /* Error 'x' is the value of every expression it is nested in, up to
+       the one this run was started for, so everything still pending is
+       dropped without being evaluated */
+    for (;;) {
+        fp = &mvm_frames[mvm_nframes - 1];
+        while (mvm_sp > fp->sp) { mothval_del(mvm_stack[--mvm_sp]); }
+        mchunk_release(c);
+        if (frame) { menv_del(frame); }
+        if (--mvm_nframes == base) { return x; }
+
+        fp = &mvm_frames[mvm_nframes - 1];
+        c = fp->c;
+        frame = fp->frame;
+    }
+
+#undef READ_ARG
+#undef VM_CASE
+#undef VM_NEXT
 }
 
-int main(int argc, char *argv[])
+/* Evaluate 'v', taking ownership of it */
+mothval *moth_eval(menv *e, mothval *v)
+{
+    if (moth_tree_walk) { return mothval_eval(e, v); }
+
+    if (mothval_type(v) == MOTHVAL_SYM) {
+        mothval *x = menv_get(e, v);
+        mothval_del(v);
+        return x;
+    }
+
+    if (mothval_type(v) != MOTHVAL_SEXPR) { return v; }
+
+    int dyn;
+    mchunk *c = mvm_code(v, e, &dyn);
+    mothval *x = mvm_run(e, c, dyn);
+    mothval_del(v);
+    return x;
+}
+
+/*
+ * Whole-list builtins
+ *
+ * 'map', 'filter' and 'fold' apply a function to each cell of a
+ * Q-Expression in turn, straight from its cell array. 'pmap' and
+ * 'preduce' split the cells into runs of moth_grain and fork a task for
+ * each run, when there is more than one thread and the function only
+ * computes values, and are 'map' and 'fold' otherwise. 'preduce' folds
+ * each run from the initial value, then folds the results of the runs
+ * in order, so it gives what 'fold' does when the function is
+ * associative and the initial value is its identity.
+ *
+ * The collector only finds values a builtin holds on to while the VM
+ * runs if they are on the value stack, so that is where these keep the
+ * lists they are working on, and read them back from after each call.
+ */
+
+/* Keep 'v' on the value stack, where the collector finds it, and return
+   its slot there */
+static int mvm_hold(mothval *v)
+{
+    if (mvm_sp == mvm_cap) {
+        mvm_cap = mvm_cap ? mvm_cap * 2 : 256;
+        mvm_stack = realloc(mvm_stack, sizeof(mothval *) * mvm_cap);
+    }
+    mvm_stack[mvm_sp] = v;
+    return mvm_sp++;
+}
+
+/* Apply 'f' to the arguments in 'a', which it takes over, and evaluate
+   the expression it leaves in place of the call, if any, to a value */
+mothval *moth_apply(menv *e, mothval *f, mothval *a)
+{
+    mothval *x = mothval_call(e, f, a);
+    if (x != MOTHVAL_TAIL) { return x; }
+
+    mothval *body = mtail_expr;
+    menv *te = mtail_env;
+    int frame = mtail_frame;
+
+    if (moth_tree_walk) {
+        body = mothval_unshare(body);
+        body->type = MOTHVAL_SEXPR;
+        x = mothval_eval_sexpr(te, body);
+    } else {
+        int dyn;
+        mchunk *c = mvm_code(body, te, &dyn);
+        int k = mvm_hold(body);
+        x = mvm_run(te, c, dyn);
+        mothval_del(mvm_stack[k]);
+        mvm_sp = k;
+    }
+
+    if (frame) { menv_del(te); }
+    return x;
+}
+
+/* Apply 'f' to 'x', and to 'y' after it unless it is NULL. Takes over
+   both */
+static mothval *mlist_apply(menv *e, mothval *f, mothval *x, mothval *y)
+{
+    mothval *a = mothval_sexpr();
+    mothval_append(a, &x, 1);
+    if (y) { mothval_append(a, &y, 1); }
+    return moth_apply(e, f, a);
+}
+
+static int mothval_is_fn(mothval *v)
 {
-    /* Create parsers */
-    mpc_parser_t *Number = mpc_new("number");
-    mpc_parser_t *Symbol = mpc_new("symbol");
-    mpc_parser_t *Sexpr = mpc_new("sexpr");
-    mpc_parser_t *Qexpr = mpc_new("qexpr");
-    mpc_parser_t *Expr = mpc_new("expr");
-    mpc_parser_t *Moth = mpc_new("moth");
-
-    /* Define language using parsers */
-    mpca_lang(MPCA_LANG_DEFAULT,
-              "                                                         \
-               number   : /-?[0-9]+/ ;                                  \
-               symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;                                       \
-               sexpr    : '(' <expr>* ')' ;                             \
-               qexpr    : '{' <expr>* '}' ;                             \
-               expr     : <number> | <symbol> | <sexpr> | <qexpr> ;     \
-               moth     : /^/ <expr>* /$/ ;                             \
-              ",
-              Number, Symbol, Sexpr, Qexpr, Expr, Moth);
-
-    puts("Moth v0.1\n");
-    puts("Press Ctrl-C to exit\n");
-
-    while (1) {
-        char *input = readline("moth> ");
-        add_history(input);
-
-        /* Parse user input */
-        mpc_result_t r;
-        if (mpc_parse("<stdin>", input, Moth, &r)) {
-            mothval *x = mothval_eval(mothval_read(r.output));
-            mothval_println(x);
+    return mothval_type(v) == MOTHVAL_FUN || mothval_type(v) == MOTHVAL_LAMBDA;
+}
+
+/* The list of the results of applying function cell 0 of 'a' to each
+   cell of list cell 1, or with 'keep' set, the list of the cells it
+   returns true for. Takes over 'a' */
+static mothval *mlist_map(menv *e, mothval *a, int keep)
+{
+    int n = a->cell[1]->count;
+    mothval *r = mothval_qexpr();
+    mothval_reserve(r, n);
+
+    int ka = mvm_hold(a);
+    int kr = mvm_hold(r);
+    mothval *x = NULL;
+
+    for (int i = 0; i < n; i++) {
+        a = mvm_stack[ka];
+        mothval *c = a->cell[1]->cell[i];
+        x = mlist_apply(e, a->cell[0], mothval_copy(c), NULL);
+        if (mothval_type(x) == MOTHVAL_ERR) { break; }
+
+        if (keep) {
+            if (mothval_type(x) != MOTHVAL_NUM) {
+                mothval_del(x);
+                x = mothval_error(MERR_FILTER_COND);
+                break;
+            }
+            int t = mothval_to_num(x) != 0;
             mothval_del(x);
-            mpc_ast_delete(r.output);
+            x = NULL;
+            if (!t) { continue; }
+            x = mothval_copy(mvm_stack[ka]->cell[1]->cell[i]);
+        }
+        mothval_append(mvm_stack[kr], &x, 1);
+        x = NULL;
+    }
+
+    a = mvm_stack[ka];
+    r = mvm_stack[kr];
+    mvm_sp = ka;
+    mothval_del(a);
+
+    if (x) {
+        mothval_del(r);
+        return x;
+    }
+    return r;
+}
+
+/* Fold function cell 0 of '*ap' over the cells lo..hi of list cell 2,
+   starting from 'acc', and leave '*ap' where the collector moved it.
+   Takes over 'acc' but not '*ap' */
+static mothval *mlist_fold(menv *e, mothval **ap, mothval *acc, int lo, int hi)
+{
+    mothval *a = *ap;
+    int ka = mvm_hold(a);
+    int kx = mvm_hold(acc);
+
+    for (int i = lo; i < hi; i++) {
+        a = mvm_stack[ka];
+        acc = mlist_apply(e, a->cell[0], mvm_stack[kx],
+                          mothval_copy(a->cell[2]->cell[i]));
+        mvm_stack[kx] = acc;
+        if (mothval_type(acc) == MOTHVAL_ERR) { break; }
+    }
+
+    *ap = mvm_stack[ka];
+    acc = mvm_stack[kx];
+    mvm_sp = ka;
+    return acc;
+}
+
+mothval *builtin_map(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 2, MERR_MAP_ARGS);
+
+    LASSERT(a, mothval_is_fn(a->cell[0])
+               && mothval_type(a->cell[1]) == MOTHVAL_QEXPR, MERR_MAP_TYPE);
+
+    return mlist_map(e, a, 0);
+}
+
+mothval *builtin_filter(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 2, MERR_FILTER_ARGS);
+
+    LASSERT(a, mothval_is_fn(a->cell[0])
+               && mothval_type(a->cell[1]) == MOTHVAL_QEXPR, MERR_FILTER_TYPE);
+
+    return mlist_map(e, a, 1);
+}
+
+mothval *builtin_fold(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 3, MERR_FOLD_ARGS);
+
+    LASSERT(a, mothval_is_fn(a->cell[0])
+               && mothval_type(a->cell[2]) == MOTHVAL_QEXPR, MERR_FOLD_TYPE);
+
+    mothval *x = mlist_fold(e, &a, mothval_copy(a->cell[1]), 0, a->cell[2]->count);
+    mothval_del(a);
+    return x;
+}
+
+/* Apply 'f' to each cell of task 't's run of list 'v', into 'out' */
+static mothval *mpar_map_run(mpar_task *t)
+{
+    for (int i = t->lo; i < t->hi; i++) {
+        if (mpar_cancelled(t)) { return mothval_error(MERR_CANCELLED); }
+        mothval *x = mlist_apply(t->e, t->f, mothval_copy(t->v->cell[i]), NULL);
+        if (mothval_type(x) == MOTHVAL_ERR) { return x; }
+        t->out[i] = x;
+    }
+    return mothval_num(0);
+}
+
+/* Fold task 't's run of the list in call 'v' */
+static mothval *mpar_fold_run(mpar_task *t)
+{
+    return mlist_fold(t->e, &t->v, mothval_copy(t->v->cell[1]), t->lo, t->hi);
+}
+
+/* Fork a task for each run of moth_grain cells of list 'l', which 'run'
+   applies 'f' to, and wait for them. Returns the error of the first
+   that failed, or NULL with the tasks in '*tasks' to be freed */
+static mothval *mpar_split(menv *e, mothval *f, mothval *v, mothval *l,
+                           mothval *(*run)(mpar_task *t), mothval **out,
+                           mpar_task **tasks, int *ntasks)
+{
+    int grain = moth_grain > 0 ? moth_grain : 1;
+    int n = (l->count + grain - 1) / grain;
+    mpar_task *t = malloc(sizeof(mpar_task) * n);
+    mpar_task **ts = malloc(sizeof(mpar_task *) * n);
+    mpar_group g = { INT_MAX, n, mpar_cur };
+
+    for (int i = 0; i < n; i++) {
+        t[i].run = run;
+        t[i].e = e;
+        t[i].v = v;
+        t[i].result = NULL;
+        t[i].index = i;
+        t[i].g = &g;
+        t[i].f = f;
+        t[i].lo = i * grain;
+        t[i].hi = i == n - 1 ? l->count : (i + 1) * grain;
+        t[i].out = out;
+        ts[i] = &t[i];
+    }
+
+    __atomic_add_fetch(&mpar_calls, 1, __ATOMIC_RELAXED);
+    mpar_push(ts, n);
+    mpar_join(&g);
+    free(ts);
+
+    mothval *err = NULL;
+    if (g.failed != INT_MAX) {
+        err = t[g.failed].result;
+        t[g.failed].result = NULL;
+        for (int i = 0; i < n; i++) {
+            if (t[i].result) { mothval_del(t[i].result); }
+        }
+        free(t);
+        t = NULL;
+    }
+
+    *tasks = t;
+    *ntasks = n;
+    return err;
+}
+
+/* Whether list 'l' is worth splitting between threads for 'f' */
+static int mpar_worth_split(menv *e, mothval *f, mothval *l)
+{
+    int grain = moth_grain > 0 ? moth_grain : 1;
+    return l->count > grain && mpar_can_fork() && mpar_pure_apply(e, f, l);
+}
+
+mothval *builtin_pmap(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 2, MERR_PMAP_ARGS);
+
+    LASSERT(a, mothval_is_fn(a->cell[0])
+               && mothval_type(a->cell[1]) == MOTHVAL_QEXPR, MERR_PMAP_TYPE);
+
+    mothval *l = a->cell[1];
+    if (!mpar_worth_split(e, a->cell[0], l)) { return mlist_map(e, a, 0); }
+
+    mothval **out = calloc(l->count, sizeof(mothval *));
+    mpar_task *t;
+    int n;
+    mothval *x = mpar_split(e, a->cell[0], l, l, mpar_map_run, out, &t, &n);
+
+    if (x) {
+        for (int i = 0; i < l->count; i++) {
+            if (out[i]) { mothval_del(out[i]); }
+        }
+    } else {
+        x = mothval_qexpr();
+        mothval_append(x, out, l->count);
+        free(t);
+    }
+
+    free(out);
+    mothval_del(a);
+    return x;
+}
+
+mothval *builtin_preduce(menv *e, mothval *a)
+{
+    LASSERT(a, a->count == 3, MERR_PREDUCE_ARGS);
+
+    LASSERT(a, mothval_is_fn(a->cell[0])
+               && mothval_type(a->cell[2]) == MOTHVAL_QEXPR, MERR_PREDUCE_TYPE);
+
+    mothval *l = a->cell[2];
+    if (!mpar_worth_split(e, a->cell[0], l)) {
+        mothval *x = mlist_fold(e, &a, mothval_copy(a->cell[1]), 0, l->count);
+        mothval_del(a);
+        return x;
+    }
+
+    mpar_task *t;
+    int n;
+    mothval *x = mpar_split(e, a->cell[0], a, l, mpar_fold_run, NULL, &t, &n);
+
+    /* Fold the results of the runs in order, each taken over */
+    if (!x) {
+        x = mothval_copy(a->cell[1]);
+        int i = 0;
+        for (; i < n && mothval_type(x) != MOTHVAL_ERR; i++) {
+            x = mlist_apply(e, a->cell[0], x, t[i].result);
+        }
+        for (; i < n; i++) { mothval_del(t[i].result); }
+        free(t);
+    }
+
+    mothval_del(a);
+    return x;
+}
+
+/*
+ * Contexts
+ *
+ * A context is one interpreter: a global environment, the free lists
+ * its values are allocated from, and the memory and VM counters of
+ * what ran in it. A thread runs code in a context between
+ * moth_ctx_enter and moth_ctx_leave, which swap the context's free
+ * lists and counters with the thread's own, so that contexts running on
+ * different threads at once share nothing that changes but the symbol
+ * table, which is locked. Options and registered builtins are set up
+ * before any context is made.
+ *
+ * The VM stacks, the line arena and the collector's heap belong to the
+ * thread, and are empty between evaluations, except for the heap: with
+ * the collector on, a context stays on the thread that made it.
+ */
+
+struct moth_ctx {
+    menv *env;
+    mmem_free_obj *free_list[MMEM_CLASSES];
+    mmem_counters mem;
+    mvm_counters vm;
+};
+
+/* Free memory of deleted contexts, which new ones start with */
+static mmem_free_obj *moth_ctx_spare[MMEM_CLASSES];
+static pthread_mutex_t moth_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void moth_ctx_swap(moth_ctx *c)
+{
+    for (int i = 0; i < MMEM_CLASSES; i++) {
+        mmem_free_obj *o = mmem_free_list[i];
+        mmem_free_list[i] = c->free_list[i];
+        c->free_list[i] = o;
+    }
+
+    mmem_counters m = mmem_stats;
+    mmem_stats = c->mem;
+    c->mem = m;
+
+    mvm_counters v = mvm_stats;
+    mvm_stats = c->vm;
+    c->vm = v;
+}
+
+/* Run code in 'c' on this thread until moth_ctx_leave */
+void moth_ctx_enter(moth_ctx *c) { moth_ctx_swap(c); }
+void moth_ctx_leave(moth_ctx *c) { moth_ctx_swap(c); }
+
+moth_ctx *moth_ctx_new(void)
+{
+    moth_ctx *c = calloc(1, sizeof(moth_ctx));
+
+    pthread_mutex_lock(&moth_ctx_lock);
+    for (int i = 0; i < MMEM_CLASSES; i++) {
+        c->free_list[i] = moth_ctx_spare[i];
+        moth_ctx_spare[i] = NULL;
+    }
+    pthread_mutex_unlock(&moth_ctx_lock);
+
+    moth_ctx_enter(c);
+    c->env = menv_new();
+    menv_add_builtins(c->env);
+    moth_ctx_leave(c);
+    return c;
+}
+
+/* Free 'c' and its environment, keeping its free memory for the next
+   context made on any thread */
+void moth_ctx_del(moth_ctx *c)
+{
+    moth_ctx_enter(c);
+    menv_del(c->env);
+    moth_ctx_leave(c);
+
+    pthread_mutex_lock(&moth_ctx_lock);
+    for (int i = 0; i < MMEM_CLASSES; i++) {
+        mmem_free_obj *o = c->free_list[i];
+        if (!o) { continue; }
+        while (o->next) { o = o->next; }
+        o->next = moth_ctx_spare[i];
+        moth_ctx_spare[i] = c->free_list[i];
+    }
+    pthread_mutex_unlock(&moth_ctx_lock);
+    free(c);
+}
+
+/* Free what this thread keeps for running contexts, when it is done
+   with them. Its free memory goes to the next context made */
+void moth_thread_end(void)
+{
+    if (moth_lazy_free) { mothval_lazy_drain(-1); }
+
+    pthread_mutex_lock(&moth_ctx_lock);
+    for (int i = 0; i < MMEM_CLASSES; i++) {
+        while (mmem_free_list[i]) {
+            mmem_free_obj *o = mmem_free_list[i];
+            mmem_free_list[i] = o->next;
+            o->next = moth_ctx_spare[i];
+            moth_ctx_spare[i] = o;
+        }
+    }
+    pthread_mutex_unlock(&moth_ctx_lock);
+
+    while (mmem_arena) {
+        mmem_block *b = mmem_arena;
+        mmem_arena = b->next;
+        free(b);
+    }
+
+    free(mothval_dead); mothval_dead = NULL; mothval_dead_cap = 0;
+    free(mprint_stack); mprint_stack = NULL; mprint_cap = 0;
+    free(mcopy_stack); mcopy_stack = NULL; mcopy_cap = 0;
+    free(mscan_stack); mscan_stack = NULL; mscan_cap = 0;
+    free(mwalk_stack); mwalk_stack = NULL; mwalk_cap = 0;
+    free(mvm_tasks); mvm_tasks = NULL; mvm_tasks_cap = 0;
+    free(mvm_quotes); mvm_quotes = NULL; mvm_quotes_cap = 0;
+    free(mvm_stack); mvm_stack = NULL; mvm_cap = 0;
+    free(mvm_frames); mvm_frames = NULL; mvm_frames_cap = 0;
+}
+
+/* Read and evaluate line 's' in 'c', as the REPL does */
+mothval *moth_eval_string(moth_ctx *c, const char *s)
+{
+    moth_ctx_enter(c);
+    mothval *x = moth_eval(c->env, mothval_read(s));
+    moth_ctx_leave(c);
+    return x;
+}
+
+/*
+ * Files of code are read with read(2), taking whatever is there, up to
+ * a block at a time, and each line is evaluated as soon as it is
+ * complete: at the first newline outside any brackets, so an expression
+ * can go on over as many lines as it needs. A file of any size, with
+ * lines of any length, is run in one pass, and lines typed into a pipe
+ * are run as they arrive, not once a block of them has built up.
+ */
+
+typedef struct {
+    int fd;
+    FILE *out;      /* flushed before waiting for more input, or NULL */
+    char *buf;
+    size_t cap;
+    size_t len;     /* bytes read into 'buf' */
+    size_t pos;     /* start of the next line */
+    size_t scan;    /* how far the next line has been looked through */
+    int depth;      /* brackets open at 'scan' */
+    int line;       /* number of the line at 'pos' */
+} moth_stream;
+
+static void moth_stream_init(moth_stream *st, FILE *f, FILE *out)
+{
+    st->fd = fileno(f);
+    st->out = out;
+    st->cap = 4096;
+    st->buf = malloc(st->cap);
+    st->len = st->pos = st->scan = 0;
+    st->depth = 0;
+    st->line = 1;
+}
+
+/* The next line of code, ended in place, and in '*line' the number of
+   the line it starts on. NULL at the end of the file */
+static char *moth_stream_next(moth_stream *st, int *line)
+{
+    for (;;) {
+        char *b = st->buf;
+        for (; st->scan < st->len; st->scan++) {
+            char c = b[st->scan];
+            if (c == '(' || c == '{') {
+                st->depth++;
+            } else if (c == ')' || c == '}') {
+                st->depth--;
+            } else if (c == '\n' && st->depth <= 0) {
+                break;
+            }
+        }
+
+        int done = st->scan < st->len;
+        if (!done) {
+            /* Keep the unfinished line, and read more after it */
+            memmove(b, b + st->pos, st->len - st->pos);
+            st->len -= st->pos;
+            st->scan -= st->pos;
+            st->pos = 0;
+            if (st->len + 1 == st->cap) {
+                st->cap *= 2;
+                st->buf = realloc(st->buf, st->cap);
+            }
+
+            if (st->out) { fflush(st->out); }
+            ssize_t n;
+            do {
+                n = read(st->fd, st->buf + st->len, st->cap - st->len - 1);
+            } while (n < 0 && errno == EINTR);
+            if (n > 0) {
+                st->len += n;
+                continue;
+            }
+            if (st->pos == st->len) { return NULL; }
+            b = st->buf;
+        }
+
+        char *s = b + st->pos;
+        b[st->scan] = '\0';
+        *line = st->line;
+        for (char *p = s; *p; p++) { st->line += *p == '\n'; }
+        if (done) { st->line++; st->scan++; }
+        st->pos = st->scan;
+        st->depth = 0;
+        return s;
+    }
+}
+
+/* Syntax error 'x' from reading a line that starts on line 'line' of
+   'path', with its position made one in the file */
+static mothval *moth_file_error(mothval *x, const char *path, int line)
+{
+    int l, n;
+    const char *m = mothval_err_msg(x);
+    if (mothval_err_code(x) != MERR_SYNTAX || sscanf(m, "%d:%n", &l, &n) != 1) {
+        return x;
+    }
+
+    char msg[512];
+    snprintf(msg, sizeof(msg), "%s:%d:%s", path, line + l - 1, m + n);
+    mothval_del(x);
+    x = mothval_err(msg);
+    x->num = MERR_SYNTAX;
+    return x;
+}
+
+/* Read line 's', on line 'line' of 'path'. Returns NULL if it is blank */
+static mothval *moth_read_line(char *s, const char *path, int line)
+{
+    mothval *v = mothval_read(s);
+    if (mothval_type(v) == MOTHVAL_ERR) { return moth_file_error(v, path, line); }
+    if (v->count == 0) {
+        mothval_del(v);
+        return NULL;
+    }
+    return v;
+}
+
+mothval *moth_eval_file(moth_ctx *c, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    moth_ctx_enter(c);
+
+    if (!f) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Could not open file '%s'!", path);
+        mothval *x = mothval_err(msg);
+        moth_ctx_leave(c);
+        return x;
+    }
+
+    moth_stream st;
+    moth_stream_init(&st, f, NULL);
+    mothval *x = mothval_sexpr();
+    char *s;
+    int line;
+
+    while ((s = moth_stream_next(&st, &line))) {
+        mothval *v = moth_read_line(s, path, line);
+        if (!v) { continue; }
+        mothval_del(x);
+        x = moth_eval(c->env, v);
+        if (mothval_type(x) == MOTHVAL_ERR) { break; }
+
+        /* Between lines is a safe point, where the collector has to find
+           the value held on to */
+        if (moth_lazy_free) { mothval_lazy_drain(moth_pause_budget); }
+        int k = mvm_hold(x);
+        mgc_poll(c->env);
+        x = mvm_stack[k];
+        mvm_sp = k;
+    }
+
+    moth_ctx_leave(c);
+    free(st.buf);
+    fclose(f);
+    return x;
+}
+
+int moth_type(mothval *v) { return mothval_type(v); }
+long moth_num(mothval *v) { return mothval_to_num(v); }
+const char *moth_err(mothval *v) { return mothval_err_msg(v); }
+const char *moth_sym(mothval *v) { return v->sym->name; }
+int moth_count(mothval *v) { return v->count; }
+mothval *moth_cell(mothval *v, int i) { return v->cell[i]; }
+void moth_print(mothval *v) { mothval_print(v); }
+void moth_free(mothval *v) { mothval_del(v); }
+
+mothval *moth_new_num(long x) { return mothval_num(x); }
+mothval *moth_new_err(const char *msg) { return mothval_err(msg); }
+mothval *moth_copy(mothval *v) { return mothval_copy(v); }
+
+#ifndef MOTH_NO_MAIN
+/* Evaluate 'v', read from a line, unless it was blank, and print its
+   value. Then tidy up before the next line. Returns whether it failed */
+static int moth_run_line(menv *e, mothval *v)
+{
+    int failed = 0;
+    if (v) {
+        /* A syntax error is read as an error value, which evaluates to
+           itself */
+        mothval *x = moth_eval(e, v);
+        failed = mothval_type(x) == MOTHVAL_ERR;
+        mothval_println(x);
+        mothval_del(x);
+    }
+
+    if (moth_line_arena) { mmem_arena_reset(); }
+    if (moth_lazy_free) { mothval_lazy_drain(moth_pause_budget); }
+    mgc_poll(e);
+    return failed;
+}
+
+/* Run the script in 'f', read from 'path', printing the value of each
+   line. Returns whether any line failed */
+static int moth_run_script(menv *e, FILE *f, const char *path)
+{
+    /* Values are printed as they come, but written out in blocks, and
+       whenever the script has to wait for more of itself */
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+    moth_stream st;
+    moth_stream_init(&st, f, stdout);
+    int failed = 0;
+    char *s;
+    int line;
+
+    while ((s = moth_stream_next(&st, &line))) {
+        if (moth_line_arena) { mmem_arena_begin(); }
+        failed |= moth_run_line(e, moth_read_line(s, path, line));
+    }
+
+    free(st.buf);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = 1;
+    char *script = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            moth_tree_walk = 1;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            moth_line_arena = 1;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            moth_deep_copy = 1;
+        } else if (strcmp(argv[i], "-g") == 0) {
+            moth_gc = 1;
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            moth_lazy_free = 1;
+            moth_pause_budget = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc
+                   && atoi(argv[i + 1]) >= 1
+                   && atoi(argv[i + 1]) <= MPAR_MAX_THREADS) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-G") == 0 && i + 1 < argc
+                   && atoi(argv[i + 1]) >= 1) {
+            moth_grain = atoi(argv[++i]);
+        } else if (!script && (strcmp(argv[i], "-") == 0 || argv[i][0] != '-')) {
+            script = argv[i];
         } else {
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
+            fprintf(stderr, "usage: %s [-t] [-a] [-d] [-g] [-l ms] [-p threads] "
+                    "[-G grain] [file | -]\n", argv[0]);
+            return 1;
         }
-        free(input);
     }
 
-    /* Undefine and delete parsers */
-    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Moth);
+    /* The collector frees values one by one, not with the line */
+    if (moth_gc && moth_line_arena) {
+        fprintf(stderr, "%s: -a and -g cannot be combined\n", argv[0]);
+        return 1;
+    }
 
-    return 0;
+    /* Dead lists have to outlive the line, and the collector has none */
+    if (moth_lazy_free && (moth_line_arena || moth_gc)) {
+        fprintf(stderr, "%s: -l cannot be combined with -a or -g\n", argv[0]);
+        return 1;
+    }
+
+    /* Only the VM runs calls in parallel, and the line arena, the
+       collector and lazy freeing each keep state for one thread */
+    if (threads > 1 && (moth_tree_walk || moth_line_arena || moth_gc
+                        || moth_lazy_free)) {
+        fprintf(stderr, "%s: -p cannot be combined with -t, -a, -g or -l\n",
+                argv[0]);
+        return 1;
+    }
+    FILE *f = NULL;
+    if (script) {
+        f = strcmp(script, "-") == 0 ? stdin : fopen(script, "rb");
+        if (!f) {
+            fprintf(stderr, "%s: could not open '%s'\n", argv[0], script);
+            return 1;
+        }
+    }
+
+    mpar_start(threads);
+
+    moth_ctx *ctx = moth_ctx_new();
+    moth_ctx_enter(ctx);
+    menv *e = ctx->env;
+    int failed = 0;
+
+    if (f) {
+        failed = moth_run_script(e, f, f == stdin ? "stdin" : script);
+        if (f != stdin) { fclose(f); }
+    } else {
+        puts("Moth v0.1\n");
+        puts("Press Ctrl-C to exit\n");
+
+        while (1) {
+            char *input = readline("moth> ");
+            if (!input) { break; }
+            add_history(input);
+
+            if (moth_line_arena) { mmem_arena_begin(); }
+            moth_run_line(e, mothval_read(input));
+            free(input);
+        }
+    }
+
+    moth_ctx_leave(ctx);
+    moth_ctx_del(ctx);
+
+    /* Nothing is reachable any more */
+    if (moth_gc) { mgc_collect(NULL); }
+    if (moth_lazy_free) { mothval_lazy_drain(-1); }
+
+    return failed;
 }
+#endif
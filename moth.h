@@ -0,0 +1,70 @@
+#ifndef MOTH_H
+#define MOTH_H
+
+/*
+ * Embedding Moth
+ *
+ * 'make lib' builds libmoth.a and libmoth.so, which hold the interpreter
+ * without the REPL. A program makes a context, evaluates Moth code in it
+ * and looks at the values that come back, which it owns and frees with
+ * moth_free. Each context has a global environment of its own, and
+ * contexts can run at once on different threads, one thread at a time
+ * in each. A thread that is done running contexts calls
+ * moth_thread_end.
+ *
+ * A value belongs to the context it came from, and may share cells with
+ * its environment, whose counts are not atomic. So it is looked at,
+ * copied and freed only on a thread that could run that context then:
+ * one thread at a time, and never while another is running it.
+ */
+
+/* Only what is declared here is exported from the library */
+#if defined(__GNUC__)
+#define MOTH_API __attribute__((visibility("default")))
+#else
+#define MOTH_API
+#endif
+
+typedef struct mothval mothval;
+typedef struct moth_ctx moth_ctx;
+
+/* Possible Moth value types */
+enum { MOTHVAL_NUM, MOTHVAL_ERR, MOTHVAL_SYM, MOTHVAL_SEXPR,
+       MOTHVAL_QEXPR, MOTHVAL_FUN, MOTHVAL_LAMBDA };
+
+MOTH_API moth_ctx *moth_ctx_new(void);
+MOTH_API void moth_ctx_del(moth_ctx *c);
+MOTH_API void moth_thread_end(void);
+
+/* Evaluate a line, as the REPL does, or every line of a file, where an
+   expression whose brackets are still open goes on to the next line.
+   A file gives the value of its last line, or of the first that fails */
+MOTH_API mothval *moth_eval_string(moth_ctx *c, const char *s);
+MOTH_API mothval *moth_eval_file(moth_ctx *c, const char *path);
+
+/* Looking at values. Each expects a value of the type it is for, and a
+   list for moth_count and moth_cell, whose cells stay owned by it */
+MOTH_API int moth_type(mothval *v);
+MOTH_API long moth_num(mothval *v);
+MOTH_API const char *moth_err(mothval *v);
+MOTH_API const char *moth_sym(mothval *v);
+MOTH_API int moth_count(mothval *v);
+MOTH_API mothval *moth_cell(mothval *v, int i);
+MOTH_API void moth_print(mothval *v);
+MOTH_API void moth_free(mothval *v);
+
+/* A builtin written in C. It is given the list of a call's arguments,
+   which stays owned by the caller, and returns a new value, or NULL for
+   an empty S-Expression. An error it returns fails the call */
+typedef mothval *(*moth_builtin)(mothval *args);
+
+/* Bind 'name' to 'f' in every context made after this. Builtins are
+   registered before any context runs on another thread */
+MOTH_API void moth_register_builtin(const char *name, moth_builtin f);
+
+/* Values for a builtin to return */
+MOTH_API mothval *moth_new_num(long x);
+MOTH_API mothval *moth_new_err(const char *msg);
+MOTH_API mothval *moth_copy(mothval *v);
+
+#endif